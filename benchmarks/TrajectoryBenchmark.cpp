@@ -0,0 +1,104 @@
+#include "Core/Log.h"
+#include "Core/Serializer.h"
+#include "Simulation/Simulation.h"
+#include "Simulation/Trajectory.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <thread>
+
+// records a short raw run of a cloud, replays it through the compressed writer at a few tolerances and
+// reports the size against the raw file, the worst position error and how fast playback can decode it
+//
+//     bazel run //:trajectory_benchmark -- [simulation, hugecloud by default] [steps, 64 by default]
+
+static double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    Log::Init();
+    std::string path = argc > 1 ? argv[1] : "examples/hugecloud.fsim";
+    uint64_t steps = argc > 2 ? std::stoull(argv[2]) : 64;
+    Ref<Simulation> simulation = CreateRef<Simulation>();
+    if (!Serializer::DeserializeSimulation(simulation, path)) {
+        FATAL("Could not load {}", path);
+        return 1;
+    }
+    simulation->SetLength(simulation->Timestep() * steps);
+    simulation->SetNumLocalWorkers(std::max(1u, std::thread::hardware_concurrency()));
+    simulation->SetSimulationRecord(true);
+    simulation->SetRecordPolicy(SimulationRecordPolicy::STEPS);
+    simulation->SetRecordInterval(1);
+    simulation->SetKeyframeInterval(0);
+    simulation->SetRecordVelocities(false);
+    simulation->SetRecordTolerance(0.0);
+    simulation->Prime();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    simulation->StartLocal();
+    while (!simulation->Finished()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    simulation->Checkup();
+    TrajectoryReader& raw = simulation->Trajectory();
+    if (!raw.IsOpen() || raw.Frames() == 0) {
+        FATAL("The simulation left no trajectory to compress");
+        return 1;
+    }
+    size_t particles = raw.Particles();
+    uint64_t frames = raw.Frames();
+    uint64_t rawbytes = std::filesystem::file_size(raw.Path());
+    printf("%s: %zu particles, %llu frames simulated in %.2fs, raw trajectory %.1f MB\n\n", path.c_str(), particles,
+        (unsigned long long)frames, Seconds(start), rawbytes / 1e6);
+    printf("%10s %8s %12s %14s %14s %14s\n", "tolerance", "ratio", "max error", "encode MP/s", "play MP/s", "seek MP/s");
+    std::vector<double> radii(particles);
+    for (size_t i = 0; i < particles; i++) radii[i] = raw.Radius(i);
+    for (double tolerance : { 1e-2, 1e-3, 1e-4, 1e-6 }) {
+        std::string file = std::string(TRAJECTORY_DIRECTORY) + "/benchmark_" + std::to_string(tolerance) + ".traj";
+        TrajectoryWriter writer;
+        start = std::chrono::steady_clock::now();
+        writer.Open(file, radii, false, raw.Timestep(), simulation->UnitSize(), tolerance);
+        for (uint64_t f = 0; f < frames; f++) {
+            raw.Seek(f);
+            ParticleFrame* frame = writer.Acquire(raw.Step());
+            for (size_t i = 0; i < particles; i++) {
+                glm::dvec3 position = raw.Position(i);
+                frame->x[i] = position.x;
+                frame->y[i] = position.y;
+                frame->z[i] = position.z;
+            }
+            writer.Publish();
+        }
+        writer.Close();
+        double encode = Seconds(start);
+        TrajectoryReader compressed;
+        if (!compressed.Open(file)) continue;
+        double error = 0.0;
+        for (uint64_t f = 0; f < frames; f++) {
+            raw.Seek(f);
+            compressed.Seek(f);
+            for (size_t i = 0; i < particles; i++) {
+                glm::dvec3 difference = raw.Position(i) - compressed.Position(i);
+                error = std::max({ error, std::abs(difference.x), std::abs(difference.y), std::abs(difference.z) });
+            }
+        }
+        // playback walks forward, scrubbing jumps anywhere and has to start over from the anchor
+        compressed.Close();
+        compressed.Open(file);
+        start = std::chrono::steady_clock::now();
+        for (uint64_t f = 0; f < frames; f++) compressed.Seek(f);
+        double play = Seconds(start);
+        std::mt19937_64 random(7);
+        start = std::chrono::steady_clock::now();
+        for (uint64_t f = 0; f < frames; f++) compressed.Seek(random() % frames);
+        double seek = Seconds(start);
+        double positions = (double)particles * frames / 1e6;
+        printf("%10.0e %7.1fx %12.3e %14.1f %14.1f %14.1f\n", tolerance, (double)rawbytes / std::filesystem::file_size(file),
+            error, positions / encode, positions / play, positions / seek);
+        compressed.Close();
+        std::error_code ignored;
+        std::filesystem::remove(file, ignored);
+    }
+    return 0;
+}
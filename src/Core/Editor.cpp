@@ -151,7 +151,7 @@ void Editor::DrawPrompts() {
 	static bool s_connection_failure = false;
 	static SimulationDetails s_remote_details = { 0 };
 	const char* length_units[] = { "ticks", "us", "ms", "s" };
-	const char* solver_options[] = { "RKF45", "Euler", "LeapFrog" };
+	const char* solver_options[] = { "RKF45", "Euler", "LeapFrog", "Forest-Ruth", "Yoshida 4th", "Yoshida 6th" };
 	char tbuffer[2048];
 	ImGuiIO& io = ImGui::GetIO();
 	auto boldFont = io.Fonts->Fonts[0];
@@ -307,7 +307,7 @@ void Editor::DrawPrompts() {
 					ImGui::Dummy({0, gapsize});
 					ImGui::Text("%s", solver_options[(int)m_Simulation->Solver()]);
 					ImGui::Dummy({0, gapsize});
-					snprintf(tbuffer, 2048, "%.3f by %.3f", m_Simulation->Bounds().x, m_Simulation->Bounds().y);
+					snprintf(tbuffer, 2048, "%.3f by %.3f by %.3f%s", m_Simulation->Bounds().x, m_Simulation->Bounds().y, m_Simulation->Bounds().z, m_Simulation->Boundary() == SimulationBoundary::PERIODIC ? " (periodic)" : "");
 					ImGui::Text("%s", tbuffer);
 					ImGui::Dummy({0, gapsize});
 					if (m_Simulation->DynamicTimestep())
@@ -674,16 +674,28 @@ void Editor::DrawStaticParticles() {
 }
 
 void Editor::DrawPlaybackParticles() {
-	if (m_Simulation->SimulationRecord().size() <= (uint64_t)m_PlaybackFrameTime) {
+	if (PlaybackFrames() <= (uint64_t)m_PlaybackFrameTime) {
 		m_PlaybackStarted = false;
 		m_PlaybackState = EditorPlaybackState::READY;
 		return;
 	}
-	for (Particle particle : m_Simulation->SimulationRecord()[(size_t)m_PlaybackFrameTime]) {
-		Renderer::DrawSphere({
-			(glm::vec3)particle.Position(),
-			(float)particle.Radius()
-		});
+	// local runs are read straight out of the mapped trajectory, remote runs still arrive as particles
+	TrajectoryReader& trajectory = m_Simulation->Trajectory();
+	if (trajectory.IsOpen()) {
+		trajectory.Seek((uint64_t)m_PlaybackFrameTime);
+		for (size_t i = 0; i < trajectory.Particles(); i++) {
+			Renderer::DrawSphere({
+				(glm::vec3)trajectory.Position(i),
+				(float)trajectory.Radius(i)
+			});
+		}
+	} else {
+		for (Particle& particle : m_Simulation->SimulationRecord()[(size_t)m_PlaybackFrameTime]) {
+			Renderer::DrawSphere({
+				(glm::vec3)particle.Position(),
+				(float)particle.Radius()
+			});
+		}
 	}
 	if (m_PlaybackState != EditorPlaybackState::PAUSED)
 		m_PlaybackFrameTime += m_PlaybackSpeed;
@@ -711,11 +723,22 @@ void Editor::ResumePlayback() {
 void Editor::StepPlayback(int steps) {
 	m_PlaybackFrameTime += (float)steps;
 	if (m_PlaybackFrameTime < 0.0f) m_PlaybackFrameTime = 0.0f;
-	if (m_PlaybackFrameTime > m_Simulation->SimulationRecord().size()) m_PlaybackFrameTime = m_Simulation->SimulationRecord().size();
+	if (m_PlaybackFrameTime > PlaybackFrames()) m_PlaybackFrameTime = PlaybackFrames();
+}
+
+void Editor::RestoreKeyframe() {
+	// the scene takes the state of the nearest keyframe at or before the paused frame
+	if (m_Simulation->RestoreKeyframe((uint64_t)m_PlaybackFrameTime)) StopPlayback();
+	else WARN("No keyframe recorded up to this frame, enable keyframes to restart from a recording");
 }
 
 float Editor::PlaybackProgression() {
-	if (m_Simulation->SimulationRecord().size() == 0) return 0.0f;
+	if (PlaybackFrames() == 0) return 0.0f;
 	if (m_PlaybackState == EditorPlaybackState::READY) return 1.0f;
-	return (float)(m_PlaybackFrameTime/m_Simulation->SimulationRecord().size());
+	return (float)(m_PlaybackFrameTime/PlaybackFrames());
+}
+
+size_t Editor::PlaybackFrames() {
+	if (m_Simulation->Trajectory().IsOpen()) return m_Simulation->Trajectory().Frames();
+	return m_Simulation->SimulationRecord().size();
 }
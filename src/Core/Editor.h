@@ -46,6 +46,7 @@ public:
 	void PausePlayback();
 	void ResumePlayback();
 	void StepPlayback(int steps);
+	void RestoreKeyframe();
     float PlaybackProgression();
     void SetPlaybackSpeed(float speed) { m_PlaybackSpeed = speed; };
     float PlaybackSpeed() { return m_PlaybackSpeed; };
@@ -60,6 +61,7 @@ private:
 private:
     void DrawStaticParticles();
     void DrawPlaybackParticles();
+    size_t PlaybackFrames();
 private:
     std::vector<Ref<Panel>> m_Panels;
     Ref<Simulation> m_Simulation;
@@ -88,6 +88,8 @@ std::string Serializer::SerializeSimulation(const Ref<Simulation> simulation) {
         out << YAML::BeginMap;
         out << YAML::Key << "ID" << YAML::Value << grid->ID();
         out << YAML::Key << "Name" << YAML::Value << grid->Name();
+        out << YAML::Key << "Resolution" << YAML::Value << grid->Resolution();
+        out << YAML::Key << "Split" << YAML::Value << grid->Split();
         out << YAML::EndMap;
     }
     out << YAML::EndSeq;
@@ -109,9 +111,29 @@ std::string Serializer::SerializeSimulation(const Ref<Simulation> simulation) {
 	out << YAML::Key << "Length Unit" << YAML::Value << (int)simulation->LengthUnit();
 	out << YAML::Key << "Simulation Length" << YAML::Value << simulation->Length();
 	out << YAML::Key << "Safeguard Cache Enabled" << YAML::Value << simulation->SafeguardCacheEnabled();
+	out << YAML::Key << "Safeguard Interval" << YAML::Value << simulation->SafeguardSeconds();
 	out << YAML::Key << "Simulation Record Enabled" << YAML::Value << simulation->SimulationRecordEnabled();
+	out << YAML::Key << "Record Velocities" << YAML::Value << simulation->RecordVelocities();
+	out << YAML::Key << "Record Tolerance" << YAML::Value << simulation->RecordTolerance();
+	out << YAML::Key << "Record Policy" << YAML::Value << (int)simulation->RecordPolicy();
+	out << YAML::Key << "Record Interval" << YAML::Value << simulation->RecordInterval();
+	out << YAML::Key << "Record Seconds" << YAML::Value << simulation->RecordSeconds();
+	out << YAML::Key << "Record Displacement" << YAML::Value << simulation->RecordDisplacement();
+	out << YAML::Key << "Keyframe Interval" << YAML::Value << simulation->KeyframeInterval();
 	out << YAML::Key << "Solver" << YAML::Value << (int)simulation->Solver();
+	out << YAML::Key << "Solver Tolerance" << YAML::Value << simulation->SolverTolerance();
 	out << YAML::Key << "Technique" << YAML::Value << (int)simulation->Technique();
+	out << YAML::Key << "Tree Backend" << YAML::Value << (int)simulation->TreeBackend();
+	out << YAML::Key << "Tree Construction" << YAML::Value << (int)simulation->TreeConstruction();
+	out << YAML::Key << "Tree Update" << YAML::Value << (int)simulation->TreeUpdate();
+	out << YAML::Key << "Leaf Size" << YAML::Value << simulation->LeafSize();
+	out << YAML::Key << "Opening Criterion" << YAML::Value << (int)simulation->Opening();
+	out << YAML::Key << "Opening Angle" << YAML::Value << simulation->Theta();
+	out << YAML::Key << "Softening Length" << YAML::Value << simulation->Softening();
+	out << YAML::Key << "Multipole Order" << YAML::Value << (int)simulation->Multipole();
+	out << YAML::Key << "Expansion Order" << YAML::Value << simulation->ExpansionOrder();
+	out << YAML::Key << "Direct Precision" << YAML::Value << (int)simulation->Precision();
+	out << YAML::Key << "Boundary" << YAML::Value << (int)simulation->Boundary();
 	out << YAML::Key << "Bounds" << YAML::Value << simulation->Bounds();
 	out << YAML::Key << "Dynamic Timestep" << YAML::Value << simulation->DynamicTimestep();
 	out << YAML::Key << "Timestep" << YAML::Value << simulation->Timestep();
@@ -261,10 +283,12 @@ bool Serializer::DeserializeSimulation(Ref<Simulation> simulation, const std::st
                 griddata["Name"]) {
                 Ref<Grid> grid = CreateRef<Grid>(griddata["ID"].as<uint64_t>());
                 grid->SetName(griddata["Name"].as<std::string>());
+                if (griddata["Resolution"]) grid->SetResolution(griddata["Resolution"].as<uint32_t>());
+                if (griddata["Split"]) grid->SetSplit(griddata["Split"].as<double>());
                 simulation->Grids().push_back(grid);
-            } else WARN("Resource data for serialized source is missing critical data - deserialization for this resource will be skipped");
+            } else WARN("Resource data for serialized grid is missing critical data - deserialization for this resource will be skipped");
         }
-    } else WARN("No sources found to serialize into simulation!");
+    } else WARN("No grids found to serialize into simulation!");
 
     if (yamldata["Particles"]) {
         auto particles = yamldata["Particles"];
@@ -298,20 +322,104 @@ bool Serializer::DeserializeSimulation(Ref<Simulation> simulation, const std::st
 		simulation->SetSafeguardCache(yamldata["Safeguard Cache Enabled"].as<bool>());
 	} else WARN("No safeguard cache setting found to serialize into simulation!");
 
+	if (yamldata["Safeguard Interval"]) {
+		simulation->SetSafeguardSeconds(yamldata["Safeguard Interval"].as<double>());
+	} else WARN("No safeguard interval found to serialize into simulation!");
+
 	if (yamldata["Simulation Record Enabled"]) {
 		simulation->SetSimulationRecord(yamldata["Simulation Record Enabled"].as<bool>());
 	} else WARN("No simulation record setting found to serialize into simulation!");
 
+	if (yamldata["Record Velocities"]) {
+		simulation->SetRecordVelocities(yamldata["Record Velocities"].as<bool>());
+	} else WARN("No record velocities setting found to serialize into simulation!");
+
+	if (yamldata["Record Tolerance"]) {
+		simulation->SetRecordTolerance(yamldata["Record Tolerance"].as<double>());
+	} else WARN("No record tolerance found to serialize into simulation!");
+
+	if (yamldata["Record Policy"]) {
+		simulation->SetRecordPolicy((SimulationRecordPolicy)yamldata["Record Policy"].as<int>());
+	} else WARN("No record policy found to serialize into simulation!");
+
+	if (yamldata["Record Interval"]) {
+		simulation->SetRecordInterval(yamldata["Record Interval"].as<uint64_t>());
+	} else WARN("No record interval found to serialize into simulation!");
+
+	if (yamldata["Record Seconds"]) {
+		simulation->SetRecordSeconds(yamldata["Record Seconds"].as<double>());
+	} else WARN("No record seconds found to serialize into simulation!");
+
+	if (yamldata["Record Displacement"]) {
+		simulation->SetRecordDisplacement(yamldata["Record Displacement"].as<double>());
+	} else WARN("No record displacement found to serialize into simulation!");
+
+	if (yamldata["Keyframe Interval"]) {
+		simulation->SetKeyframeInterval(yamldata["Keyframe Interval"].as<uint64_t>());
+	} else WARN("No keyframe interval found to serialize into simulation!");
+
 	if (yamldata["Solver"]) {
 		simulation->SetSolver((SimulationSolver)yamldata["Solver"].as<int>());
 	} else WARN("No solver found to serialize into simulation!");
 
+	if (yamldata["Solver Tolerance"]) {
+		simulation->SetSolverTolerance(yamldata["Solver Tolerance"].as<double>());
+	} else WARN("No solver tolerance found to serialize into simulation!");
+
 	if (yamldata["Technique"]) {
 		simulation->SetTechnique((SimulationTechnique)yamldata["Technique"].as<int>());
 	} else WARN("No technique found to serialize into simulation!");
 
+	if (yamldata["Tree Backend"]) {
+		simulation->SetTreeBackend((SimulationTreeBackend)yamldata["Tree Backend"].as<int>());
+	} else WARN("No tree backend found to serialize into simulation!");
+
+	if (yamldata["Tree Construction"]) {
+		simulation->SetTreeConstruction((SimulationTreeConstruction)yamldata["Tree Construction"].as<int>());
+	} else WARN("No tree construction found to serialize into simulation!");
+
+	if (yamldata["Tree Update"]) {
+		simulation->SetTreeUpdate((SimulationTreeUpdate)yamldata["Tree Update"].as<int>());
+	} else WARN("No tree update found to serialize into simulation!");
+
+	if (yamldata["Leaf Size"]) {
+		simulation->SetLeafSize(yamldata["Leaf Size"].as<uint32_t>());
+	} else WARN("No leaf size found to serialize into simulation!");
+
+	if (yamldata["Opening Criterion"]) {
+		simulation->SetOpening((OpeningCriterion)yamldata["Opening Criterion"].as<int>());
+	} else WARN("No opening criterion found to serialize into simulation!");
+
+	if (yamldata["Opening Angle"]) {
+		simulation->SetTheta(yamldata["Opening Angle"].as<double>());
+	} else WARN("No opening angle found to serialize into simulation!");
+
+	if (yamldata["Softening Length"]) {
+		simulation->SetSoftening(yamldata["Softening Length"].as<double>());
+	} else WARN("No softening length found to serialize into simulation!");
+
+	if (yamldata["Multipole Order"]) {
+		simulation->SetMultipole((SimulationMultipole)yamldata["Multipole Order"].as<int>());
+	} else WARN("No multipole order found to serialize into simulation!");
+
+	if (yamldata["Expansion Order"]) {
+		simulation->SetExpansionOrder(yamldata["Expansion Order"].as<uint32_t>());
+	} else WARN("No expansion order found to serialize into simulation!");
+
+	if (yamldata["Direct Precision"]) {
+		simulation->SetPrecision((SimulationPrecision)yamldata["Direct Precision"].as<int>());
+	} else WARN("No direct precision found to serialize into simulation!");
+
+	if (yamldata["Boundary"]) {
+		simulation->SetBoundary((SimulationBoundary)yamldata["Boundary"].as<int>());
+	} else WARN("No boundary found to serialize into simulation!");
+
 	if (yamldata["Bounds"]) {
-		simulation->SetBounds(yamldata["Bounds"].as<glm::vec2>());
+		// older files only stored a width and height, give their box a depth equal to its height
+		if (yamldata["Bounds"].size() == 2) {
+			glm::dvec2 bounds = yamldata["Bounds"].as<glm::dvec2>();
+			simulation->SetBounds({ bounds.x, bounds.y, bounds.y });
+		} else simulation->SetBounds(yamldata["Bounds"].as<glm::dvec3>());
 	} else WARN("No bounds found to serialize into simulation!");
 
 	if (yamldata["Dynamic Timestep"]) {
@@ -12,7 +12,6 @@ void ControlPanel::Initialize() {
 		    "\n\t- Simulation cache settings"
 		    "\n\t- Simulation recording"
 		    "\n\t- Simulation solver"
-		    "\n\t- Bounds"
 		    "\n\t- Timestep"
 		    "\n\t- Remote Workers");
 }
@@ -27,10 +26,42 @@ void ControlPanel::Update(Editor* context) {
     ImGui::Dummy({0, gapsize});
     ImGui::Text("Simulation Record");
     ImGui::Dummy({0, gapsize});
+    ImGui::Text("Record Policy");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Keyframe Interval");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Record Velocities");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Record Tolerance");
+    ImGui::Dummy({0, gapsize});
     ImGui::Text("Simulation Solver");
     ImGui::Dummy({0, gapsize});
+    ImGui::Text("Solver Tolerance");
+    ImGui::Dummy({0, gapsize});
     ImGui::Text("Simulation Technique");
     ImGui::Dummy({0, gapsize});
+    ImGui::Text("Tree Backend");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Tree Construction");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Tree Update");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Leaf Size");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Opening Criterion");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Opening Angle");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Softening Length");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Multipole Order");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Expansion Order");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Direct Precision");
+    ImGui::Dummy({0, gapsize});
+    ImGui::Text("Boundary");
+    ImGui::Dummy({0, gapsize});
     ImGui::Text("Bounds");
     ImGui::Dummy({0, gapsize});
     ImGui::Text("Timestep");
@@ -58,36 +89,141 @@ void ControlPanel::Update(Editor* context) {
 	bool checkbox = context->GetSimulation()->SafeguardCacheEnabled();
     if (ImGui::Checkbox("##safeguardcache", &checkbox))
 	    context->GetSimulation()->SetSafeguardCache(checkbox);
+	ImGui::SameLine();
+	double safeguard = context->GetSimulation()->SafeguardSeconds();
+	if (ImGui::InputDouble("##safeguardseconds", &safeguard, 0.0, 0.0, "every %.0f s"))
+	    context->GetSimulation()->SetSafeguardSeconds(safeguard > 1.0 ? safeguard : 1.0);
 	checkbox = context->GetSimulation()->SimulationRecordEnabled();
     ImGui::Dummy({0, gapsize});
     if (ImGui::Checkbox("##simulationrecord", &checkbox))
 	    context->GetSimulation()->SetSimulationRecord(checkbox);
+    ImGui::Dummy({0, gapsize});
+	int current_policy = (int)context->GetSimulation()->RecordPolicy();
+    const char* policy_options[] = { "Every Nth Step", "Wall Clock", "Displacement" };
+    if (ImGui::Combo("##recordpolicy", &current_policy, policy_options, IM_ARRAYSIZE(policy_options)))
+	    context->GetSimulation()->SetRecordPolicy((SimulationRecordPolicy)current_policy);
+	ImGui::SameLine();
+	if (context->GetSimulation()->RecordPolicy() == SimulationRecordPolicy::STEPS) {
+		uint64_t interval = context->GetSimulation()->RecordInterval();
+		if (ImGui::DragScalar("##recordinterval", ImGuiDataType_U64, &interval, 1.0f))
+		    context->GetSimulation()->SetRecordInterval(interval > 0 ? interval : 1);
+	} else if (context->GetSimulation()->RecordPolicy() == SimulationRecordPolicy::WALLCLOCK) {
+		double seconds = context->GetSimulation()->RecordSeconds();
+		if (ImGui::InputDouble("##recordseconds", &seconds, 0.0, 0.0, "%.2f s"))
+		    context->GetSimulation()->SetRecordSeconds(seconds > 0.0 ? seconds : 0.0);
+	} else {
+		double displacement = context->GetSimulation()->RecordDisplacement();
+		if (ImGui::InputDouble("##recorddisplacement", &displacement, 0.0, 0.0, "%.1e"))
+		    context->GetSimulation()->SetRecordDisplacement(displacement > 0.0 ? displacement : 0.0);
+	}
+    ImGui::Dummy({0, gapsize});
+	uint64_t keyframes = context->GetSimulation()->KeyframeInterval();
+	if (ImGui::DragScalar("##keyframeinterval", ImGuiDataType_U64, &keyframes, 1.0f))
+	    context->GetSimulation()->SetKeyframeInterval(keyframes);
+	checkbox = context->GetSimulation()->RecordVelocities();
+    ImGui::Dummy({0, gapsize});
+    if (ImGui::Checkbox("##recordvelocities", &checkbox))
+	    context->GetSimulation()->SetRecordVelocities(checkbox);
+    ImGui::Dummy({0, gapsize});
+	double recordtolerance = context->GetSimulation()->RecordTolerance();
+    if (ImGui::InputDouble("##recordtolerance", &recordtolerance, 0.0, 0.0, "%.1e")) {
+	    context->GetSimulation()->SetRecordTolerance(recordtolerance > 0.0 ? recordtolerance : 0.0);
+	}
     ImGui::Dummy({0, gapsize});
 	int current_solver = (int)context->GetSimulation()->Solver();
-    const char* solver_options[] = { "RKF45", "Euler", "LeapFrog" };
+    const char* solver_options[] = { "RKF45", "Euler", "LeapFrog", "Forest-Ruth", "Yoshida 4th", "Yoshida 6th" };
     if (ImGui::Combo("##simulationsolver", &current_solver, solver_options, IM_ARRAYSIZE(solver_options)))
 	    context->GetSimulation()->SetSolver((SimulationSolver)current_solver);
+    ImGui::Dummy({0, gapsize});
+	double tolerance = context->GetSimulation()->SolverTolerance();
+    if (ImGui::InputDouble("##solvertolerance", &tolerance, 0.0, 0.0, "%.1e")) {
+	    context->GetSimulation()->SetSolverTolerance(tolerance);
+	}
     ImGui::Dummy({0, gapsize});
 	int current_technique = (int)context->GetSimulation()->Technique();
-    const char* technique_options[] = { "Barnes-Hut", "Naive Particle", "Edge Distribution" };
+    const char* technique_options[] = { "Barnes-Hut", "Naive Particle", "Edge Distribution", "Fast Multipole", "Particle Mesh", "Tree Particle Mesh" };
     if (ImGui::Combo("##simulationtechnique", &current_technique, technique_options, IM_ARRAYSIZE(technique_options)))
 	    context->GetSimulation()->SetTechnique((SimulationTechnique)current_technique);
+    ImGui::Dummy({0, gapsize});
+	int current_backend = (int)context->GetSimulation()->TreeBackend();
+    const char* backend_options[] = { "Flat Arena", "Pointer" };
+    if (ImGui::Combo("##treebackend", &current_backend, backend_options, IM_ARRAYSIZE(backend_options)))
+	    context->GetSimulation()->SetTreeBackend((SimulationTreeBackend)current_backend);
+    ImGui::Dummy({0, gapsize});
+	int current_construction = (int)context->GetSimulation()->TreeConstruction();
+    const char* construction_options[] = { "Morton Sort", "Insertion" };
+    if (ImGui::Combo("##treeconstruction", &current_construction, construction_options, IM_ARRAYSIZE(construction_options)))
+	    context->GetSimulation()->SetTreeConstruction((SimulationTreeConstruction)current_construction);
+    ImGui::Dummy({0, gapsize});
+	int current_update = (int)context->GetSimulation()->TreeUpdate();
+    const char* update_options[] = { "Rebuild", "Refit" };
+    if (ImGui::Combo("##treeupdate", &current_update, update_options, IM_ARRAYSIZE(update_options)))
+	    context->GetSimulation()->SetTreeUpdate((SimulationTreeUpdate)current_update);
+    ImGui::Dummy({0, gapsize});
+    uint32_t leaf_size = context->GetSimulation()->LeafSize();
+    uint32_t min_leaf = 1;
+    uint32_t max_leaf = MAX_LEAF_SIZE;
+    if (ImGui::SliderScalar("##leafsize", ImGuiDataType_U32, &leaf_size, &min_leaf, &max_leaf))
+        context->GetSimulation()->SetLeafSize(leaf_size);
+    ImGui::Dummy({0, gapsize});
+	int current_opening = (int)context->GetSimulation()->Opening();
+    const char* opening_options[] = { "Geometric", "Min Distance", "Relative Force" };
+    if (ImGui::Combo("##openingcriterion", &current_opening, opening_options, IM_ARRAYSIZE(opening_options)))
+	    context->GetSimulation()->SetOpening((OpeningCriterion)current_opening);
+    ImGui::Dummy({0, gapsize});
+    double theta = context->GetSimulation()->Theta();
+    if (ImGui::InputDouble("##openingangle", &theta, 0.0, 0.0, "%.2f")) {
+	    context->GetSimulation()->SetTheta(theta);
+	}
+    ImGui::Dummy({0, gapsize});
+    double softening = context->GetSimulation()->Softening();
+    if (ImGui::InputDouble("##softeninglength", &softening, 0.0, 0.0, "%.3f")) {
+	    context->GetSimulation()->SetSoftening(softening);
+	}
+    ImGui::Dummy({0, gapsize});
+	int current_multipole = (int)context->GetSimulation()->Multipole();
+    const char* multipole_options[] = { "Quadrupole", "Monopole" };
+    if (ImGui::Combo("##multipoleorder", &current_multipole, multipole_options, IM_ARRAYSIZE(multipole_options)))
+	    context->GetSimulation()->SetMultipole((SimulationMultipole)current_multipole);
+    ImGui::Dummy({0, gapsize});
+    uint32_t expansion_order = context->GetSimulation()->ExpansionOrder();
+    uint32_t min_order = 1;
+    uint32_t max_order = FMM_MAX_ORDER;
+    if (ImGui::SliderScalar("##expansionorder", ImGuiDataType_U32, &expansion_order, &min_order, &max_order))
+        context->GetSimulation()->SetExpansionOrder(expansion_order);
+    ImGui::Dummy({0, gapsize});
+	int current_precision = (int)context->GetSimulation()->Precision();
+    const char* precision_options[] = { "Double", "Mixed Float" };
+    if (ImGui::Combo("##directprecision", &current_precision, precision_options, IM_ARRAYSIZE(precision_options)))
+	    context->GetSimulation()->SetPrecision((SimulationPrecision)current_precision);
+    ImGui::Dummy({0, gapsize});
+    int current_boundary = (int)context->GetSimulation()->Boundary();
+    const char* boundary_options[] = { "Open", "Periodic" };
+    if (ImGui::Combo("##boundary", &current_boundary, boundary_options, IM_ARRAYSIZE(boundary_options)))
+	    context->GetSimulation()->SetBoundary((SimulationBoundary)current_boundary);
     ImGui::Dummy({0, gapsize});
     double bounds_x = context->GetSimulation()->Bounds().x;
     double bounds_y = context->GetSimulation()->Bounds().y;
+    double bounds_z = context->GetSimulation()->Bounds().z;
     bool bounds_set = false;
-    float availableWidth = ImGui::GetContentRegionAvail().x - ImGui::CalcTextSize("by").x;
-    ImGui::SetNextItemWidth(availableWidth * 0.5f);
+    float availableWidth = ImGui::GetContentRegionAvail().x - 2.0f * ImGui::CalcTextSize("by").x;
+    ImGui::SetNextItemWidth(availableWidth / 3.0f);
     if (ImGui::InputDouble("##bounds_x", &bounds_x, 0.0, 0.0, "%.3f"))
 	    bounds_set = true;
     ImGui::SameLine();
     ImGui::Text("by");
     ImGui::SameLine();
-    ImGui::SetNextItemWidth(availableWidth * 0.5f);
+    ImGui::SetNextItemWidth(availableWidth / 3.0f);
     if (ImGui::InputDouble("##bounds_y", &bounds_y, 0.0, 0.0, "%.3f"))
         bounds_set = true;
+    ImGui::SameLine();
+    ImGui::Text("by");
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(availableWidth / 3.0f);
+    if (ImGui::InputDouble("##bounds_z", &bounds_z, 0.0, 0.0, "%.3f"))
+        bounds_set = true;
     if (bounds_set)
-	    context->GetSimulation()->SetBounds({bounds_x, bounds_y});
+	    context->GetSimulation()->SetBounds({bounds_x, bounds_y, bounds_z});
     ImGui::Dummy({0, gapsize});
     bool dynamic_timestep = context->GetSimulation()->DynamicTimestep();
     if (ImGui::Checkbox("Dynamic", &dynamic_timestep))
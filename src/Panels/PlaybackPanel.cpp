@@ -24,6 +24,8 @@ void PlaybackPanel::Update(Editor* context) {
     ImGui::Dummy({0, gapsize});
     ImGui::Text("Stepsize");
     ImGui::Dummy({0, gapsize});
+    ImGui::Text("Keyframe");
+    ImGui::Dummy({0, gapsize});
     ImGui::Text("Progress");
 	ImGui::NextColumn();
     gapsize = 2.0f;
@@ -71,6 +73,16 @@ void PlaybackPanel::Update(Editor* context) {
 		ImGui::EndDisabled();
     ImGui::Dummy({0, gapsize});
 	ImGui::DragInt("##stepsize", &stepsize, 1, 1, INT_MAX);
+    ImGui::Dummy({0, gapsize});
+	// restoring stops playback, so the disabled state is decided once up front
+	bool restorable = !simfinished || context->PlaybackState() == EditorPlaybackState::PAUSED;
+	if (!restorable)
+		ImGui::BeginDisabled();
+	if (ImGui::Button("Restore", {75, 0})) {
+		context->RestoreKeyframe();
+	}
+	if (!restorable)
+		ImGui::EndDisabled();
     ImGui::Dummy({0, gapsize});
 	float progress = 100.0f * context->PlaybackProgression();
 	char buffer[1024];
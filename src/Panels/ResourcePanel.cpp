@@ -53,6 +53,25 @@ void ResourcePanel::Update(Editor* context) {
 		DrawEditName(sink);
 	} else if ((grid = GetSelectedGrid(context))) {
 		DrawEditName(grid);
+		ImGui::Dummy({0, 2});
+		ImGui::Columns(2);
+		ImGui::SetColumnWidth(0, 100);
+		ImGui::Text("Resolution");
+		ImGui::NextColumn();
+		int resolution = (int)grid->Resolution();
+		if (ImGui::InputInt("##resolution", &resolution, 0, 0, ImGuiInputTextFlags_EnterReturnsTrue))
+			grid->SetResolution(resolution < 0 ? 0 : (uint32_t)resolution);
+		ImGui::Columns(1);
+		ImGui::Dummy({0, 2});
+		ImGui::Columns(2);
+		ImGui::SetColumnWidth(0, 100);
+		ImGui::Text("Split");
+		ImGui::NextColumn();
+		double split = grid->Split();
+		if (ImGui::InputDouble("##split", &split, 0, 0, "%.3f"))
+			grid->SetSplit(split);
+		ImGui::Columns(1);
+		ImGui::Dummy({0, 2});
 	} else if ((particle = GetSelectedParticle(context))) {
 		DrawEditName(particle);
 		ImGui::Dummy({0, 2});
@@ -0,0 +1,74 @@
+#include "Barrier.h"
+#include <thread>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() std::this_thread::yield()
+#endif
+#ifdef LINUX_BUILD
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+void PhaseBarrier::Resize(size_t workers) {
+    // spinning only pays off when the thread we wait on can run at the same time
+    m_Workers = (uint32_t)workers;
+    m_Spins = std::thread::hardware_concurrency() > 1 ? BARRIER_SPINS : 0;
+    m_Sense.store(0);
+    m_Remaining.store(0);
+}
+
+void PhaseBarrier::Release() {
+    // arm the arrival count before flipping the sense so every released worker sees it
+    m_Remaining.store(m_Workers, std::memory_order_relaxed);
+    m_Sense.store(m_Sense.load(std::memory_order_relaxed) ^ 1);
+    Wake(m_Sense);
+}
+
+void PhaseBarrier::Wait() {
+    uint32_t remaining;
+    while ((remaining = m_Remaining.load(std::memory_order_acquire)) != 0) Park(m_Remaining, remaining);
+}
+
+uint32_t PhaseBarrier::Await(uint32_t sense) {
+    while (m_Sense.load(std::memory_order_acquire) == sense) Park(m_Sense, sense);
+    return sense ^ 1;
+}
+
+void PhaseBarrier::Arrive() {
+    if (m_Remaining.fetch_sub(1) == 1) Wake(m_Remaining);
+}
+
+void PhaseBarrier::Park(std::atomic<uint32_t> &word, uint32_t expected) {
+    // spin briefly since most phases are short, then sleep until the word changes
+    for (size_t i = 0; i < m_Spins; i++) {
+        if (word.load(std::memory_order_acquire) != expected) return;
+        CPU_RELAX();
+    }
+    m_Sleepers.fetch_add(1);
+#ifdef LINUX_BUILD
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    {
+        std::unique_lock<std::mutex> lock(m_ParkLock);
+        m_ParkAlert.wait(lock, [&word, expected] { return word.load() != expected; });
+    }
+#endif
+    m_Sleepers.fetch_sub(1);
+}
+
+void PhaseBarrier::Wake(std::atomic<uint32_t> &word) {
+    // the word was already stored, so only pay for the wakeup when someone went to sleep
+    if (m_Sleepers.load() == 0) return;
+#ifdef LINUX_BUILD
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+    (void)word;
+    m_ParkLock.lock();
+    m_ParkLock.unlock();
+    m_ParkAlert.notify_all();
+#endif
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+
+#define BARRIER_SPINS 4096
+
+class PhaseBarrier {
+public:
+    void Resize(size_t workers);
+public:
+    void Release();
+    void Wait();
+    uint32_t Await(uint32_t sense);
+    void Arrive();
+private:
+    void Park(std::atomic<uint32_t> &word, uint32_t expected);
+    void Wake(std::atomic<uint32_t> &word);
+private:
+    uint32_t m_Workers = 0;
+    size_t m_Spins = 0;
+    std::atomic<uint32_t> m_Sense = 0;
+    std::atomic<uint32_t> m_Remaining = 0;
+    std::atomic<uint32_t> m_Sleepers = 0;
+    std::mutex m_ParkLock;
+    std::condition_variable m_ParkAlert;
+};
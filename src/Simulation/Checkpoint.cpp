@@ -0,0 +1,79 @@
+#include "Checkpoint.h"
+#include "Core/Log.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#define CHECKPOINT_MAGIC 0x54504b43u
+
+bool CheckpointWriter::Submit(const std::string &path, const CheckpointHeader &header, ParticleSoA &particles) {
+    // a checkpoint still on its way to disk wins, the next one is only an interval away
+    if (m_Busy.load()) return false;
+    if (m_Thread.joinable()) m_Thread.join();
+    m_Path = path;
+    m_Header = header;
+    m_Header.magic = CHECKPOINT_MAGIC;
+    m_Header.version = CHECKPOINT_VERSION;
+    m_Header.particles = particles.Size();
+    size_t n = particles.Size();
+    m_State.resize(CHECKPOINT_BLOCKS * n);
+    size_t block = 0;
+    for (AlignedDoubles* array : { &particles.px, &particles.py, &particles.pz, &particles.vx, &particles.vy, &particles.vz, &particles.ax, &particles.ay, &particles.az, &particles.mass })
+        std::copy(array->begin(), array->end(), m_State.begin() + (block++) * n);
+    m_Busy.store(true);
+    m_Thread = std::thread(&CheckpointWriter::Write, this);
+    return true;
+}
+
+void CheckpointWriter::Close() {
+    if (m_Thread.joinable()) m_Thread.join();
+}
+
+void CheckpointWriter::Write() {
+    std::error_code error;
+    std::filesystem::path target(m_Path);
+    if (!target.parent_path().empty()) std::filesystem::create_directories(target.parent_path(), error);
+    std::string temporary = m_Path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write((const char*)&m_Header, sizeof(m_Header));
+        file.write((const char*)m_State.data(), m_State.size() * sizeof(double));
+        file.flush();
+        m_Failed.store(!file);
+    }
+    // renaming over the previous checkpoint swaps it out in one go
+    if (!m_Failed.load()) std::filesystem::rename(temporary, target, error);
+    if (m_Failed.load() || error) {
+        m_Failed.store(true);
+        std::filesystem::remove(temporary, error);
+        WARN("Could not write checkpoint {}", m_Path);
+    }
+    m_Busy.store(false);
+}
+
+bool CheckpointReader::Open(const std::string &path) {
+    m_Header = {};
+    m_State.clear();
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    file.read((char*)&m_Header, sizeof(m_Header));
+    if (!file || m_Header.magic != CHECKPOINT_MAGIC || m_Header.version != CHECKPOINT_VERSION) {
+        WARN("Ignoring unreadable checkpoint {}", path);
+        return false;
+    }
+    m_State.resize(CHECKPOINT_BLOCKS * m_Header.particles);
+    file.read((char*)m_State.data(), m_State.size() * sizeof(double));
+    if (!file) {
+        WARN("Ignoring truncated checkpoint {}", path);
+        return false;
+    }
+    return true;
+}
+
+void CheckpointReader::Restore(ParticleSoA &particles) {
+    size_t block = 0;
+    for (AlignedDoubles* array : { &particles.px, &particles.py, &particles.pz, &particles.vx, &particles.vy, &particles.vz, &particles.ax, &particles.ay, &particles.az, &particles.mass }) {
+        array->assign(m_State.begin() + block * m_Header.particles, m_State.begin() + (block + 1) * m_Header.particles);
+        block++;
+    }
+}
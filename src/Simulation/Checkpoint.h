@@ -0,0 +1,57 @@
+#pragma once
+#include "Simulation/ParticleSoA.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CHECKPOINT_DIRECTORY "cache"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_BLOCKS 10
+
+// a checkpoint file is this header then the position, velocity, acceleration and mass blocks of every particle,
+// all doubles in simulation units. the origin fingerprints the scene and settings the run started from, so a
+// checkpoint only resumes the run that wrote it
+struct CheckpointHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t origin;
+    uint64_t particles;
+    uint64_t step;
+    uint64_t steps;
+    uint64_t accepted;
+    uint64_t rejected;
+    double adaptive;
+};
+
+// writes checkpoints on its own thread, the state is copied out first so the run keeps stepping while the
+// disk catches up. each goes to a temporary file renamed over the last one, so a crash never leaves a torn file
+class CheckpointWriter {
+public:
+    ~CheckpointWriter() { Close(); }
+    bool Submit(const std::string &path, const CheckpointHeader &header, ParticleSoA &particles);
+    void Close();
+    bool Busy() { return m_Busy.load(); }
+    bool Failed() { return m_Failed.load(); }
+private:
+    void Write();
+private:
+    std::thread m_Thread;
+    std::atomic<bool> m_Busy = false;
+    std::atomic<bool> m_Failed = false;
+    std::string m_Path;
+    CheckpointHeader m_Header = {};
+    std::vector<double> m_State;
+};
+
+// reads a whole checkpoint back so a run can pick up where it left off
+class CheckpointReader {
+public:
+    bool Open(const std::string &path);
+    const CheckpointHeader& Header() { return m_Header; }
+    void Restore(ParticleSoA &particles);
+private:
+    CheckpointHeader m_Header = {};
+    std::vector<double> m_State;
+};
@@ -0,0 +1,147 @@
+#include "DirectSum.h"
+#include "Simulation/Octtree.h"
+#include <algorithm>
+#include <cmath>
+
+void DirectSum::Prepare(ParticleSoA* particles, size_t partials, double unitsize, bool mixed, double softening, const glm::dvec3 &period) {
+    // pack positions and masses into tiles, padding the last one with massless particles
+    size_t count = particles->Size();
+    m_Particles = particles;
+    m_Count = count;
+    m_Mixed = mixed;
+    m_Softening2 = softening * softening;
+    // mixed runs keep positions in simulation units and masses against the heaviest particle, so the float part of
+    // the kernel stays in range at any scale, the gain puts gravity and both scales back in
+    double heaviest = 0.0;
+    for (size_t i = 0; i < count; i++) heaviest = std::max(heaviest, particles->mass[i]);
+    if (heaviest <= 0.0) heaviest = 1.0;
+    double scale = mixed ? 1.0 : unitsize;
+    double softening2 = std::max(m_Softening2 / (unitsize * unitsize), DIRECT_FLOAT_SOFTENING * DIRECT_FLOAT_SOFTENING);
+    m_FloatSoftening2 = (float)softening2;
+    m_Gain = GRAVITY * heaviest / (unitsize * unitsize);
+    // periodic boxes only fold each pair onto its nearest image, there is no ewald sum over the further ones here
+    m_Periodic = period.x > 0.0;
+    for (int k = 0; k < 3; k++) {
+        m_Period[k] = period[k];
+        m_MixedPeriod[k] = period[k] / unitsize;
+    }
+    m_Tiles = (count + DIRECT_TILE - 1) / DIRECT_TILE;
+    size_t padded = m_Tiles * DIRECT_TILE;
+    m_X.assign(padded, 0.0);
+    m_Y.assign(padded, 0.0);
+    m_Z.assign(padded, 0.0);
+    m_M.assign(padded, 0.0);
+    for (size_t i = 0; i < count; i++) {
+        m_X[i] = scale * particles->px[i];
+        m_Y[i] = scale * particles->py[i];
+        m_Z[i] = scale * particles->pz[i];
+        m_M[i] = particles->mass[i];
+    }
+    if (mixed) {
+        m_FloatM.resize(padded);
+        for (size_t i = 0; i < padded; i++) m_FloatM[i] = (float)(m_M[i] / heaviest);
+    }
+    // one partial per worker, zeroed here since a worker may steal any number of tile pair ranges
+    if (m_Partials.size() != partials) m_Partials.resize(partials);
+    for (DirectPartial& partial : m_Partials) {
+        partial.x.assign(padded, 0.0);
+        partial.y.assign(padded, 0.0);
+        partial.z.assign(padded, 0.0);
+    }
+}
+
+void DirectSum::Particles(size_t begin, size_t end) {
+    // each target block sweeps the sources one cache sized tile at a time
+    double ax[DIRECT_BLOCK];
+    double ay[DIRECT_BLOCK];
+    double az[DIRECT_BLOCK];
+    for (size_t i = begin; i < end; i += DIRECT_BLOCK) {
+        size_t count = std::min((size_t)DIRECT_BLOCK, end - i);
+        for (size_t k = 0; k < count; k++) ax[k] = ay[k] = az[k] = 0.0;
+        for (size_t j = 0; j < m_Tiles * DIRECT_TILE; j += DIRECT_TILE) {
+            if (m_Mixed)
+                ForceKernel::AccumulateMixed(&m_X[j], &m_Y[j], &m_Z[j], &m_FloatM[j], DIRECT_TILE, &m_X[i], &m_Y[i], &m_Z[i], ax, ay, az, count, m_FloatSoftening2, m_Gain, MixedPeriod());
+            else
+                ForceKernel::Accumulate(&m_X[j], &m_Y[j], &m_Z[j], &m_M[j], DIRECT_TILE, &m_X[i], &m_Y[i], &m_Z[i], ax, ay, az, count, m_Softening2, Period());
+        }
+        for (size_t k = 0; k < count; k++)
+            m_Particles->SetAcceleration(i + k, { ax[k], ay[k], az[k] });
+    }
+}
+
+void DirectSum::Targets(const std::vector<uint32_t> &targets, size_t begin, size_t end) {
+    // same sweep as Particles for a scattered subset, gathering each target block first
+    double x[DIRECT_BLOCK];
+    double y[DIRECT_BLOCK];
+    double z[DIRECT_BLOCK];
+    double ax[DIRECT_BLOCK];
+    double ay[DIRECT_BLOCK];
+    double az[DIRECT_BLOCK];
+    for (size_t i = begin; i < end; i += DIRECT_BLOCK) {
+        size_t count = std::min((size_t)DIRECT_BLOCK, end - i);
+        for (size_t k = 0; k < count; k++) {
+            uint32_t t = targets[i + k];
+            x[k] = m_X[t];
+            y[k] = m_Y[t];
+            z[k] = m_Z[t];
+            ax[k] = ay[k] = az[k] = 0.0;
+        }
+        for (size_t j = 0; j < m_Tiles * DIRECT_TILE; j += DIRECT_TILE) {
+            if (m_Mixed)
+                ForceKernel::AccumulateMixed(&m_X[j], &m_Y[j], &m_Z[j], &m_FloatM[j], DIRECT_TILE, x, y, z, ax, ay, az, count, m_FloatSoftening2, m_Gain, MixedPeriod());
+            else
+                ForceKernel::Accumulate(&m_X[j], &m_Y[j], &m_Z[j], &m_M[j], DIRECT_TILE, x, y, z, ax, ay, az, count, m_Softening2, Period());
+        }
+        for (size_t k = 0; k < count; k++)
+            m_Particles->SetAcceleration(targets[i + k], { ax[k], ay[k], az[k] });
+    }
+}
+
+void DirectSum::Edges(size_t first, size_t last, size_t worker) {
+    // walk the upper triangle of tile pairs row by row, starting at the first pair of this range
+    DirectPartial& partial = m_Partials[worker];
+    size_t a = 0;
+    size_t pair = first;
+    while (a < m_Tiles && pair >= m_Tiles - a) {
+        pair -= m_Tiles - a;
+        a++;
+    }
+    size_t b = a + pair;
+    for (size_t p = first; p < last; p++) {
+        TilePair(a, b, partial);
+        if (++b == m_Tiles) {
+            a++;
+            b = a;
+        }
+    }
+}
+
+void DirectSum::Reduce(size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        glm::dvec3 accel = { 0, 0, 0 };
+        for (DirectPartial& partial : m_Partials) {
+            accel.x += partial.x[i];
+            accel.y += partial.y[i];
+            accel.z += partial.z[i];
+        }
+        m_Particles->SetAcceleration(i, accel);
+    }
+}
+
+void DirectSum::TilePair(size_t a, size_t b, DirectPartial &partial) {
+    // a tile against itself is summed one sided, any other pair once with the reaction going back to the second tile
+    size_t i = a * DIRECT_TILE;
+    size_t j = b * DIRECT_TILE;
+    size_t count = std::min((size_t)DIRECT_TILE, m_Count - i);
+    if (a == b && m_Mixed) {
+        ForceKernel::AccumulateMixed(&m_X[j], &m_Y[j], &m_Z[j], &m_FloatM[j], DIRECT_TILE, &m_X[i], &m_Y[i], &m_Z[i], &partial.x[i], &partial.y[i], &partial.z[i], count, m_FloatSoftening2, m_Gain, MixedPeriod());
+    } else if (a == b) {
+        ForceKernel::Accumulate(&m_X[j], &m_Y[j], &m_Z[j], &m_M[j], DIRECT_TILE, &m_X[i], &m_Y[i], &m_Z[i], &partial.x[i], &partial.y[i], &partial.z[i], count, m_Softening2, Period());
+    } else if (m_Mixed) {
+        ForceKernel::AccumulatePairsMixed(&m_X[j], &m_Y[j], &m_Z[j], &m_FloatM[j], &partial.x[j], &partial.y[j], &partial.z[j], DIRECT_TILE,
+            &m_X[i], &m_Y[i], &m_Z[i], &m_FloatM[i], &partial.x[i], &partial.y[i], &partial.z[i], count, m_FloatSoftening2, m_Gain, MixedPeriod());
+    } else {
+        ForceKernel::AccumulatePairs(&m_X[j], &m_Y[j], &m_Z[j], &m_M[j], &partial.x[j], &partial.y[j], &partial.z[j], DIRECT_TILE,
+            &m_X[i], &m_Y[i], &m_Z[i], &m_M[i], &partial.x[i], &partial.y[i], &partial.z[i], count, m_Softening2, Period());
+    }
+}
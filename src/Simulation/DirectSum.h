@@ -0,0 +1,48 @@
+#pragma once
+#include "Simulation/ParticleSoA.h"
+#include "Simulation/Kernel.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+#define DIRECT_TILE 256
+#define DIRECT_BLOCK 32
+// softening floor in simulation units for the float kernels, below it a self pair's inverse cube leaves float range
+#define DIRECT_FLOAT_SOFTENING 1e-12
+
+struct DirectPartial {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+};
+
+class DirectSum {
+public:
+    void Prepare(ParticleSoA* particles, size_t partials, double unitsize, bool mixed, double softening, const glm::dvec3 &period);
+    size_t TilePairs() { return (m_Tiles * (m_Tiles + 1)) / 2; }
+public:
+    void Particles(size_t begin, size_t end);
+    void Targets(const std::vector<uint32_t> &targets, size_t begin, size_t end);
+    void Edges(size_t first, size_t last, size_t worker);
+    void Reduce(size_t begin, size_t end);
+private:
+    void TilePair(size_t a, size_t b, DirectPartial &partial);
+    const double* Period() const { return m_Periodic ? m_Period : nullptr; }
+    const double* MixedPeriod() const { return m_Periodic ? m_MixedPeriod : nullptr; }
+private:
+    ParticleSoA* m_Particles = nullptr;
+    size_t m_Count = 0;
+    size_t m_Tiles = 0;
+    bool m_Mixed = false;
+    double m_Softening2 = 0.0;
+    float m_FloatSoftening2 = 0.0f;
+    double m_Gain = 0.0;
+    bool m_Periodic = false;
+    double m_Period[3] = { 0, 0, 0 };
+    double m_MixedPeriod[3] = { 0, 0, 0 };
+    std::vector<double> m_X;
+    std::vector<double> m_Y;
+    std::vector<double> m_Z;
+    std::vector<double> m_M;
+    std::vector<float> m_FloatM;
+    std::vector<DirectPartial> m_Partials;
+};
@@ -0,0 +1,182 @@
+#include "Ewald.h"
+#include "Core/Log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#define EWALD_MAGIC 0x444c5745u
+
+void EwaldTable::Prepare(const glm::dvec3 &period, const std::string &directory) {
+    // the table only depends on the shape of the box, its size just scales the lookups
+    m_Period = period;
+    glm::dvec3 shape = period / period.x;
+    if (Ready() && shape == m_Shape) return;
+    m_Shape = shape;
+    m_Step = EWALD_REACH * shape / (double)EWALD_GRID;
+    char name[128];
+    snprintf(name, sizeof(name), "ewald_%d_%.6f_%.6f.bin", EWALD_GRID, shape.y, shape.z);
+    std::string path = directory.empty() ? std::string(name) : directory + "/" + name;
+    if (Load(path)) return;
+    INFO("Computing ewald correction table for a {} by {} by {} box", shape.x, shape.y, shape.z);
+    Compute();
+    Save(path, directory);
+}
+
+glm::dvec3 EwaldTable::Correction(const glm::dvec3 &separation, glm::dvec3* gradient) const {
+    // each component is odd in its own axis and even in the others, so only the positive octant is stored
+    glm::dvec3 u = separation / m_Period.x;
+    size_t c[3];
+    double f[3];
+    double sign[3];
+    for (int a = 0; a < 3; a++) {
+        double v = std::min(std::abs(u[a]) / m_Step[a], (double)EWALD_GRID);
+        c[a] = std::min((size_t)v, (size_t)EWALD_GRID - 1);
+        f[a] = v - (double)c[a];
+        sign[a] = u[a] < 0.0 ? -1.0 : 1.0;
+    }
+    // trilinear interpolation, z first, keeping the differences along each axis for the slope
+    const size_t sz = 3;
+    const size_t sy = (EWALD_GRID + 1) * sz;
+    const size_t sx = (EWALD_GRID + 1) * sy;
+    const double* t = &m_Table[Index(c[0], c[1], c[2])];
+    double value[3];
+    double slope[3][3];
+    for (int k = 0; k < 3; k++) {
+        double z00 = t[k] + f[2] * (t[sz + k] - t[k]);
+        double z01 = t[sy + k] + f[2] * (t[sy + sz + k] - t[sy + k]);
+        double z10 = t[sx + k] + f[2] * (t[sx + sz + k] - t[sx + k]);
+        double z11 = t[sx + sy + k] + f[2] * (t[sx + sy + sz + k] - t[sx + sy + k]);
+        double y0 = z00 + f[1] * (z01 - z00);
+        double y1 = z10 + f[1] * (z11 - z10);
+        value[k] = y0 + f[0] * (y1 - y0);
+        if (gradient) {
+            double d00 = t[sz + k] - t[k];
+            double d01 = t[sy + sz + k] - t[sy + k];
+            double d10 = t[sx + sz + k] - t[sx + k];
+            double d11 = t[sx + sy + sz + k] - t[sx + sy + k];
+            double e0 = d00 + f[1] * (d01 - d00);
+            double e1 = d10 + f[1] * (d11 - d10);
+            slope[0][k] = y1 - y0;
+            slope[1][k] = (z01 - z00) + f[0] * ((z11 - z10) - (z01 - z00));
+            slope[2][k] = e0 + f[0] * (e1 - e0);
+        }
+    }
+    double scale = 1.0 / (m_Period.x * m_Period.x);
+    if (gradient) {
+        // the change of every component along each axis, in the same units per meter
+        for (int a = 0; a < 3; a++) {
+            double along = sign[a] * scale / (m_Step[a] * m_Period.x);
+            gradient[a] = { along * sign[0] * slope[a][0], along * sign[1] * slope[a][1], along * sign[2] * slope[a][2] };
+        }
+    }
+    return { sign[0] * scale * value[0], sign[1] * scale * value[1], sign[2] * scale * value[2] };
+}
+
+void EwaldTable::Compute() {
+    // planes are independent, so spread them over every core, this only runs once per box shape
+    m_Table.assign(Index(EWALD_GRID + 1, 0, 0), 0.0);
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([this, t, threads]() {
+            for (size_t i = t; i <= EWALD_GRID; i += threads) ComputePlane(i);
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+}
+
+void EwaldTable::ComputePlane(size_t plane) {
+    // ewald summation of the acceleration from a unit mass and all its images in a box of the stored shape,
+    // split into erfc screened images and a reciprocal space sum, minus the plain pull of the nearest image
+    const double pi = 3.14159265358979323846;
+    double shortest = std::min(m_Shape.x, std::min(m_Shape.y, m_Shape.z));
+    double alpha = EWALD_ALPHA / shortest;
+    double volume = m_Shape.x * m_Shape.y * m_Shape.z;
+    // enough images for both the screened terms and the reciprocal gaussians to fall below double precision
+    int real[3];
+    int reciprocal[3];
+    for (int a = 0; a < 3; a++) {
+        real[a] = (int)std::ceil(2.75 * shortest / m_Shape[a] + 0.5);
+        reciprocal[a] = (int)std::floor(6.0 * alpha * m_Shape[a] / pi);
+    }
+    for (size_t j = 0; j <= EWALD_GRID; j++) {
+        for (size_t k = 0; k <= EWALD_GRID; k++) {
+            glm::dvec3 d = { (double)plane * m_Step.x, (double)j * m_Step.y, (double)k * m_Step.z };
+            double r2 = glm::dot(d, d);
+            // by symmetry nothing is left over at the origin itself
+            if (r2 == 0.0) continue;
+            glm::dvec3 sum = -d / (r2 * std::sqrt(r2));
+            for (int nx = -real[0]; nx <= real[0]; nx++) {
+                for (int ny = -real[1]; ny <= real[1]; ny++) {
+                    for (int nz = -real[2]; nz <= real[2]; nz++) {
+                        glm::dvec3 image = d + glm::dvec3(nx * m_Shape.x, ny * m_Shape.y, nz * m_Shape.z);
+                        double r = glm::length(image);
+                        double screen = std::erfc(alpha * r) + 2.0 * alpha * r / std::sqrt(pi) * std::exp(-alpha * alpha * r * r);
+                        sum += image * (screen / (r * r * r));
+                    }
+                }
+            }
+            for (int hx = -reciprocal[0]; hx <= reciprocal[0]; hx++) {
+                for (int hy = -reciprocal[1]; hy <= reciprocal[1]; hy++) {
+                    for (int hz = -reciprocal[2]; hz <= reciprocal[2]; hz++) {
+                        if (hx == 0 && hy == 0 && hz == 0) continue;
+                        glm::dvec3 wave = 2.0 * pi * glm::dvec3(hx / m_Shape.x, hy / m_Shape.y, hz / m_Shape.z);
+                        double k2 = glm::dot(wave, wave);
+                        double damping = k2 / (4.0 * alpha * alpha);
+                        if (damping > 36.0) continue;
+                        sum += wave * (4.0 * pi / volume * std::exp(-damping) / k2 * std::sin(glm::dot(wave, d)));
+                    }
+                }
+            }
+            double* t = &m_Table[Index(plane, j, k)];
+            t[0] = sum.x;
+            t[1] = sum.y;
+            t[2] = sum.z;
+        }
+    }
+}
+
+bool EwaldTable::Load(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    uint32_t magic = 0;
+    int32_t grid = 0;
+    double shape[2] = { 0, 0 };
+    file.read((char*)&magic, sizeof(magic));
+    file.read((char*)&grid, sizeof(grid));
+    file.read((char*)shape, sizeof(shape));
+    if (!file || magic != EWALD_MAGIC || grid != EWALD_GRID || shape[0] != m_Shape.y || shape[1] != m_Shape.z) {
+        WARN("Ignoring stale ewald table {}", path);
+        return false;
+    }
+    m_Table.resize(Index(EWALD_GRID + 1, 0, 0));
+    file.read((char*)m_Table.data(), m_Table.size() * sizeof(double));
+    if (!file) {
+        WARN("Ignoring truncated ewald table {}", path);
+        m_Table.clear();
+        return false;
+    }
+    return true;
+}
+
+void EwaldTable::Save(const std::string &path, const std::string &directory) {
+    // losing the cache only costs the next run the computation, so failures are not fatal
+    std::error_code error;
+    if (!directory.empty()) std::filesystem::create_directories(directory, error);
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        WARN("Could not cache ewald table at {}", path);
+        return;
+    }
+    uint32_t magic = EWALD_MAGIC;
+    int32_t grid = EWALD_GRID;
+    double shape[2] = { m_Shape.y, m_Shape.z };
+    file.write((const char*)&magic, sizeof(magic));
+    file.write((const char*)&grid, sizeof(grid));
+    file.write((const char*)shape, sizeof(shape));
+    file.write((const char*)m_Table.data(), m_Table.size() * sizeof(double));
+}
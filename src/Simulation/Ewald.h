@@ -0,0 +1,32 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#define EWALD_GRID 40
+#define EWALD_REACH 0.75
+#define EWALD_ALPHA 2.0
+#define EWALD_NODE_FRACTION 0.125
+#define EWALD_CACHE_DIRECTORY "cache"
+
+// what the rest of an infinite periodic lattice adds to the pull of a unit mass seen through its nearest image,
+// tabulated once per box shape over the positive octant and cached on disk, reaching past the half box since
+// cells keep one image for all their particles
+class EwaldTable {
+public:
+    bool Ready() const { return !m_Table.empty(); }
+    const glm::dvec3& Period() const { return m_Period; }
+    void Prepare(const glm::dvec3 &period, const std::string &directory);
+    glm::dvec3 Correction(const glm::dvec3 &separation, glm::dvec3* gradient = nullptr) const;
+private:
+    void Compute();
+    void ComputePlane(size_t plane);
+    bool Load(const std::string &path);
+    void Save(const std::string &path, const std::string &directory);
+    size_t Index(size_t i, size_t j, size_t k) const { return ((i * (EWALD_GRID + 1) + j) * (EWALD_GRID + 1) + k) * 3; }
+private:
+    glm::dvec3 m_Period = { 0, 0, 0 };
+    glm::dvec3 m_Shape = { 0, 0, 0 };
+    glm::dvec3 m_Step = { 0, 0, 0 };
+    std::vector<double> m_Table;
+};
@@ -0,0 +1,692 @@
+#include "FlatOcttree.h"
+#include "Simulation/Ewald.h"
+#include "Core/Log.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static uint64_t SpreadBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffff;
+    v = (v | (v << 16)) & 0x1f0000ff0000ff;
+    v = (v | (v << 8)) & 0x100f00f00f00f00f;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3;
+    v = (v | (v << 2)) & 0x1249249249249249;
+    return v;
+}
+
+static glm::dvec3 ImageShift(const glm::dvec3 &offset, const glm::dvec3 &period) {
+    // the whole number of periods that brings an offset closest to zero
+    return {
+        -period.x * std::nearbyint(offset.x / period.x),
+        -period.y * std::nearbyint(offset.y / period.y),
+        -period.z * std::nearbyint(offset.z / period.z)
+    };
+}
+
+static bool WithinHalfPeriod(const Oct &box, const glm::dvec3 &middle, const glm::dvec3 &extent, const glm::dvec3 &period) {
+    // whether every pair between a box and the group is nearest through this one image of the box
+    return std::abs(box.x - middle.x) + box.radius + extent.x <= 0.5 * period.x &&
+        std::abs(box.y - middle.y) + box.radius + extent.y <= 0.5 * period.y &&
+        std::abs(box.z - middle.z) + box.radius + extent.z <= 0.5 * period.z;
+}
+
+static uint32_t Digit(uint64_t key, int32_t level) {
+    return (uint32_t)((key >> (3 * (MORTON_LEVELS - 1 - level))) & 7);
+}
+
+void FlatOcttree::Reset(const Oct &boundary, ParticleSoA* particles) {
+    size_t count = particles->Size();
+    if (m_Nodes.size() < (count * 4) + 8) m_Nodes.resize((count * 4) + 8);
+    if (m_Parents.size() < m_Nodes.size()) m_Parents.resize(m_Nodes.size());
+    if (m_Indices.size() < count * m_LeafSize) m_Indices.resize(count * m_LeafSize);
+    m_Particles = particles;
+    m_Count = count;
+    Clear();
+    m_Nodes[0].boundary = boundary;
+}
+
+void FlatOcttree::Grow() {
+    m_Nodes.resize(m_Nodes.size() * 2);
+    m_Parents.resize(m_Nodes.size());
+    if (m_Slots > m_Indices.size()) m_Indices.resize(m_Slots * 2);
+}
+
+void FlatOcttree::Clear() {
+    m_Overflow = false;
+    m_Size = 1;
+    m_Slots = 0;
+    m_Nodes[0] = { { 0, 0, 0 }, 0.0, m_Nodes[0].boundary, -1, 0, 0, 0 };
+}
+
+void FlatOcttree::GetLeaves(std::vector<int32_t>* leaves, int32_t node) {
+    if (m_Nodes[node].child < 0) {
+        leaves->push_back(node);
+    } else {
+        for (int32_t i = 0; i < 8; i++)
+            GetLeaves(leaves, m_Nodes[node].child + i);
+    }
+}
+
+bool FlatOcttree::Insert(int32_t particle, int32_t node) {
+    if (!m_Nodes[node].boundary.Contains(m_Particles->Position(particle))) return true;
+    while (true) {
+        FlatOctNode& current = m_Nodes[node];
+        if (current.child < 0) {
+            if (current.count < m_LeafSize || current.level >= MORTON_LEVELS) {
+                // a leaf only owns the slots it was given, so its bucket moves to fresh slots one larger
+                uint32_t begin = (uint32_t)m_Slots.fetch_add(current.count + 1);
+                if (begin + current.count + 1 > m_Indices.size()) {
+                    m_Overflow = true;
+                    return false;
+                }
+                std::copy(m_Indices.begin() + current.begin, m_Indices.begin() + current.begin + current.count, m_Indices.begin() + begin);
+                m_Indices[begin + current.count] = particle;
+                current.begin = begin;
+                current.count++;
+                return true;
+            }
+
+            // a full bucket is split in place, every child keeps the run of slots its octant sorts into
+            int32_t child = Subdivide(node);
+            if (child < 0) return false;
+            const Oct& b = current.boundary;
+            auto first = m_Indices.begin() + current.begin;
+            std::stable_sort(first, first + current.count, [this, &b](uint32_t x, uint32_t y) { return Octant(b, x) < Octant(b, y); });
+            for (uint32_t i = current.begin; i < current.begin + current.count; i++) {
+                FlatOctNode& moved = m_Nodes[child + Octant(b, m_Indices[i])];
+                if (moved.count == 0) moved.begin = i;
+                moved.count++;
+            }
+            current.count = 0;
+            current.child = child;
+        }
+        node = current.child + Octant(current.boundary, particle);
+    }
+}
+
+void FlatOcttree::CalculateCenterOfMass(int32_t node) {
+    if (m_Nodes[node].child >= 0) {
+        for (int32_t i = 0; i < 8; i++)
+            CalculateCenterOfMass(m_Nodes[node].child + i);
+    }
+    Moments(node);
+}
+
+void FlatOcttree::MarkTop() {
+    // every internal node made before the workers take over sits above the subtrees they will finish
+    ResetMoments();
+    for (size_t i = 0; i < m_Size; i++) {
+        if (m_Nodes[i].child >= 0) m_Top.push_back((int32_t)i);
+    }
+}
+
+void FlatOcttree::SplitTop(std::vector<int32_t>* tasks, size_t target) {
+    // open the largest subtrees of a finished tree until there is enough independent work to hand out
+    ResetMoments();
+    tasks->clear();
+    tasks->push_back(0);
+    while (!tasks->empty() && tasks->size() < target) {
+        auto largest = std::max_element(tasks->begin(), tasks->end(), [this](int32_t a, int32_t b) {
+            return m_Nodes[a].count < m_Nodes[b].count;
+        });
+        int32_t node = *largest;
+        if (m_Nodes[node].child < 0) break;
+        tasks->erase(largest);
+        m_Top.push_back(node);
+        for (int32_t i = 0; i < 8; i++) {
+            if (m_Nodes[m_Nodes[node].child + i].child >= 0) tasks->push_back(m_Nodes[node].child + i);
+        }
+    }
+}
+
+void FlatOcttree::CombineTop() {
+    // children were split off after their parents, so walking the top backwards finishes them first
+    for (auto it = m_Top.rbegin(); it != m_Top.rend(); it++) {
+        int32_t first = m_Nodes[*it].child;
+        for (int32_t i = 0; i < 8; i++) {
+            if (m_Nodes[first + i].child < 0) Moments(first + i);
+        }
+        Moments(*it);
+    }
+    if (m_Fresh) {
+        m_BuiltDepth = m_Depth;
+        m_BuiltEmpty = m_Empty;
+        m_BuiltSize = m_Size;
+        m_Fresh = false;
+    }
+}
+
+void FlatOcttree::ResetMoments() {
+    if (m_Leaves.size() < m_Count) m_Leaves.resize(m_Count);
+    m_Depth = 0;
+    m_Empty = 0;
+    m_Top.clear();
+}
+
+void FlatOcttree::Moments(int32_t node) {
+    FlatOctNode& current = m_Nodes[node];
+    double totalMass = 0;
+    glm::dvec3 cm = { 0, 0, 0 };
+    if (current.child < 0) {
+        // remember where every particle lives, so a refit only has to look at each particle's own leaf
+        for (uint32_t i = current.begin; i < current.begin + current.count; i++) {
+            uint32_t p = m_Indices[i];
+            m_Leaves[p] = node;
+            totalMass += m_Particles->Mass(p);
+            cm += m_Particles->Mass(p) * m_Particles->Position(p);
+        }
+    } else {
+        uint32_t count = 0;
+        for (int32_t i = 0; i < 8; i++) {
+            FlatOctNode& child = m_Nodes[current.child + i];
+            count += child.count;
+            if (child.mass > 0) {
+                totalMass += child.mass;
+                cm += child.mass * child.center;
+            }
+        }
+        current.count = count;
+        if (count <= 1 && m_Refittable) {
+            // particles leaving a refitted cell leave its subtree behind, fold it back into one leaf like a fresh build would
+            int32_t first = current.child;
+            current.child = -1;
+            current.begin = 0;
+            for (int32_t i = 0; i < 8; i++) {
+                if (m_Nodes[first + i].count == 0) continue;
+                current.begin = m_Nodes[first + i].begin;
+                m_Leaves[m_Indices[current.begin]] = node;
+            }
+        } else {
+            // measure the shape of the tree, so a refit can tell when to give up on it
+            for (int32_t i = 0; i < 8; i++) {
+                FlatOctNode& child = m_Nodes[current.child + i];
+                if (child.child >= 0) continue;
+                if (child.count == 0) {
+                    m_Empty++;
+                    continue;
+                }
+                int32_t depth = m_Depth;
+                while (child.level > depth && !m_Depth.compare_exchange_weak(depth, child.level));
+            }
+        }
+    }
+    current.mass = totalMass;
+    if (totalMass > 0) current.center = cm / totalMass;
+
+    // traceless quadrupole about the center of mass, children are shifted with the parallel axis theorem
+    double* q = current.quadrupole;
+    for (int32_t k = 0; k < 6; k++) q[k] = 0.0;
+    if (totalMass <= 0) return;
+    auto accumulate = [q](double m, const glm::dvec3& s) {
+        double s2 = s.x*s.x + s.y*s.y + s.z*s.z;
+        q[0] += m * (3 * s.x * s.x - s2);
+        q[1] += m * (3 * s.x * s.y);
+        q[2] += m * (3 * s.x * s.z);
+        q[3] += m * (3 * s.y * s.y - s2);
+        q[4] += m * (3 * s.y * s.z);
+        q[5] += m * (3 * s.z * s.z - s2);
+    };
+    if (current.child < 0) {
+        for (uint32_t i = current.begin; i < current.begin + current.count; i++) {
+            uint32_t p = m_Indices[i];
+            accumulate(m_Particles->Mass(p), m_Particles->Position(p) - current.center);
+        }
+    } else {
+        for (int32_t i = 0; i < 8; i++) {
+            FlatOctNode& child = m_Nodes[current.child + i];
+            if (child.mass <= 0) continue;
+            for (int32_t k = 0; k < 6; k++) q[k] += child.quadrupole[k];
+            accumulate(child.mass, child.center - current.center);
+        }
+    }
+}
+
+void FlatOcttree::PrepareSort(size_t chunks) {
+    if (m_Keys.size() < m_Count) {
+        m_Keys.resize(m_Count);
+        m_ScratchKeys.resize(m_Count);
+        m_ScratchIndices.resize(m_Count);
+    }
+    if (m_Histograms.size() < chunks) m_Histograms.resize(chunks);
+    m_RadixPass = 0;
+}
+
+void FlatOcttree::ComputeKeys(size_t begin, size_t end) {
+    const Oct& b = m_Nodes[0].boundary;
+    double scale = (double)(1 << MORTON_LEVELS) / (2.0 * b.radius);
+    for (size_t i = begin; i < end; i++) {
+        glm::dvec3 pos = m_Particles->Position(i);
+        uint64_t q[3];
+        double rel[3] = { pos.x - (b.x - b.radius), pos.y - (b.y - b.radius), pos.z - (b.z - b.radius) };
+        for (int32_t k = 0; k < 3; k++) {
+            double v = rel[k] * scale;
+            q[k] = v <= 0.0 ? 0 : (v >= (double)((1 << MORTON_LEVELS) - 1) ? (1 << MORTON_LEVELS) - 1 : (uint64_t)v);
+        }
+        m_Keys[i] = SpreadBits(q[0]) | (SpreadBits(q[1]) << 1) | (SpreadBits(q[2]) << 2);
+        m_Indices[i] = (uint32_t)i;
+    }
+}
+
+void FlatOcttree::CountDigits(size_t begin, size_t end, size_t chunk) {
+    std::array<size_t, RADIX_BUCKETS>& histogram = m_Histograms[chunk];
+    histogram.fill(0);
+    size_t shift = m_RadixPass * RADIX_BITS;
+    for (size_t i = begin; i < end; i++)
+        histogram[(m_Keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+}
+
+bool FlatOcttree::PrefixDigits(size_t chunks) {
+    // turn the per chunk histograms into scatter offsets in chunk order, skipping passes where every key shares a digit
+    size_t offset = 0;
+    for (size_t d = 0; d < RADIX_BUCKETS; d++) {
+        size_t total = 0;
+        for (size_t w = 0; w < chunks; w++) total += m_Histograms[w][d];
+        if (total == m_Count) return false;
+        for (size_t w = 0; w < chunks; w++) {
+            size_t c = m_Histograms[w][d];
+            m_Histograms[w][d] = offset;
+            offset += c;
+        }
+    }
+    return true;
+}
+
+void FlatOcttree::ScatterDigits(size_t begin, size_t end, size_t chunk) {
+    std::array<size_t, RADIX_BUCKETS>& offsets = m_Histograms[chunk];
+    size_t shift = m_RadixPass * RADIX_BITS;
+    for (size_t i = begin; i < end; i++) {
+        size_t dst = offsets[(m_Keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        m_ScratchKeys[dst] = m_Keys[i];
+        m_ScratchIndices[dst] = m_Indices[i];
+    }
+}
+
+void FlatOcttree::NextRadixPass(bool scattered) {
+    if (scattered) {
+        m_Keys.swap(m_ScratchKeys);
+        m_Indices.swap(m_ScratchIndices);
+    }
+    m_RadixPass++;
+}
+
+void FlatOcttree::BuildTop(std::vector<int32_t>* tasks, size_t target) {
+    // split the largest pending ranges on this thread until there is enough independent work to hand out
+    tasks->clear();
+    m_Nodes[0].begin = 0;
+    m_Nodes[0].count = (uint32_t)m_Count;
+    tasks->push_back(0);
+    while (tasks->size() < target) {
+        auto largest = std::max_element(tasks->begin(), tasks->end(), [this](int32_t a, int32_t b) {
+            return m_Nodes[a].count < m_Nodes[b].count;
+        });
+        int32_t node = *largest;
+        if (m_Nodes[node].count <= m_LeafSize || m_Nodes[node].level >= MORTON_LEVELS) break;
+        tasks->erase(largest);
+        if (!Split(node)) return;
+        for (int32_t i = 0; i < 8; i++) {
+            if (m_Nodes[m_Nodes[node].child + i].count > 0)
+                tasks->push_back(m_Nodes[node].child + i);
+        }
+    }
+}
+
+bool FlatOcttree::Build(int32_t node) {
+    if (m_Nodes[node].count <= m_LeafSize || m_Nodes[node].level >= MORTON_LEVELS) return true;
+    if (!Split(node)) return false;
+    for (int32_t i = 0; i < 8; i++) {
+        if (!Build(m_Nodes[node].child + i)) return false;
+    }
+    return true;
+}
+
+bool FlatOcttree::PrepareRefit(const glm::dvec3 &lo, const glm::dvec3 &hi, ParticleSoA* particles) {
+    // the previous tree can only be kept if it still spans every particle
+    if (!m_Refittable || m_Particles != particles || m_Count != particles->Size()) return false;
+    const Oct& root = m_Nodes[0].boundary;
+    if (lo.x < root.x - root.radius || lo.y < root.y - root.radius || lo.z < root.z - root.radius ||
+        hi.x >= root.x + root.radius || hi.y >= root.y + root.radius || hi.z >= root.z + root.radius) return false;
+
+    // rebuild once reinsertion has left the tree much deeper, emptier or more fragmented than a fresh one
+    if (m_Depth > m_BuiltDepth + REFIT_DEPTH_SLACK || m_Empty > 2 * m_BuiltEmpty + 8) return false;
+    if (m_Size > 2 * m_BuiltSize) return false;
+
+    // reinsertion leaves holes behind in the index array, pack the leaves back together in tree order once they pile up
+    if (m_Slots > 2 * m_Count) {
+        if (m_ScratchIndices.size() < m_Count) m_ScratchIndices.resize(m_Count);
+        uint32_t next = 0;
+        Compact(0, next, -1);
+        std::swap(m_Indices, m_ScratchIndices);
+        m_Slots = next;
+    }
+
+    // morton builds hand out slots by range, so reinserted particles start after the last one
+    if (m_Slots < m_Count) m_Slots = m_Count;
+    return true;
+}
+
+void FlatOcttree::Evict(size_t begin, size_t end, std::vector<uint32_t>* escaped) {
+    for (size_t p = begin; p < end; p++) {
+        if (!m_Nodes[m_Leaves[p]].boundary.Contains(m_Particles->Position(p)))
+            escaped->push_back((uint32_t)p);
+    }
+}
+
+bool FlatOcttree::Reinsert(const std::vector<uint32_t> &escaped) {
+    // past a point it is cheaper to sort everything again than to walk each escaped particle down from the root
+    if (escaped.size() > m_Count / REFIT_ESCAPE_FRACTION) return false;
+
+    // take every escaped particle out of its old leaf before any of them lands somewhere new
+    for (uint32_t p : escaped) {
+        FlatOctNode& leaf = m_Nodes[m_Leaves[p]];
+        uint32_t last = leaf.begin + leaf.count - 1;
+        for (uint32_t i = leaf.begin; i <= last; i++) {
+            if (m_Indices[i] != p) continue;
+            m_Indices[i] = m_Indices[last];
+            leaf.count--;
+            break;
+        }
+    }
+    if (m_Indices.size() < m_Slots + escaped.size() * m_LeafSize) m_Indices.resize(m_Slots + escaped.size() * m_LeafSize);
+    for (uint32_t p : escaped) {
+        // the arena keeps its nodes when it grows, so make room for a full descent before each insert
+        if (m_Size + 8 * MORTON_LEVELS > m_Nodes.size()) Grow();
+
+        // most particles only drift into a neighbouring cell, so climb from the old leaf to the first box holding them again
+        int32_t node = m_Leaves[p];
+        glm::dvec3 pos = m_Particles->Position(p);
+        while (node != 0 && !m_Nodes[node].boundary.Contains(pos)) node = m_Parents[node];
+        if (!Insert((int32_t)p, node)) return false;
+    }
+    return true;
+}
+
+void FlatOcttree::CollectGroups(int32_t node) {
+    if (node == 0) m_Groups.clear();
+    if (m_Nodes[node].count == 0) return;
+    if (m_Nodes[node].count <= GROUP_SIZE || m_Nodes[node].child < 0) {
+        m_Groups.push_back(node);
+        return;
+    }
+    for (int32_t i = 0; i < 8; i++)
+        CollectGroups(m_Nodes[node].child + i);
+}
+
+size_t FlatOcttree::GroupCalculateForce(int32_t group, double unitsize, GroupScratch &scratch, bool quadrupole, const ForceParameters &parameters) {
+    // gather the group's particles and the box around them
+    scratch.targets.clear();
+    GatherParticles(group, &scratch.targets);
+    size_t count = scratch.targets.size();
+    scratch.x.resize(count);
+    scratch.y.resize(count);
+    scratch.z.resize(count);
+    scratch.ax.resize(count);
+    scratch.ay.resize(count);
+    scratch.az.resize(count);
+    glm::dvec3 lo = m_Particles->Position(scratch.targets[0]);
+    glm::dvec3 hi = lo;
+    double reference = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < count; i++) {
+        glm::dvec3 pos = m_Particles->Position(scratch.targets[i]);
+        if (parameters.opening == OpeningCriterion::RELATIVE) reference = std::min(reference, glm::length(m_Particles->Acceleration(scratch.targets[i])));
+        lo = glm::min(lo, pos);
+        hi = glm::max(hi, pos);
+        scratch.x[i] = unitsize * pos.x;
+        scratch.y[i] = unitsize * pos.y;
+        scratch.z[i] = unitsize * pos.z;
+        scratch.ax[i] = 0.0;
+        scratch.ay[i] = 0.0;
+        scratch.az[i] = 0.0;
+    }
+
+    // with periodic boundaries nodes are seen through their image nearest the group, and everything below
+    // the ewald cell size keeps the image of its cell so the correction further down sees the same images
+    bool periodic = parameters.Periodic();
+    glm::dvec3 period = parameters.period / unitsize;
+    glm::dvec3 middle = 0.5 * (lo + hi);
+    glm::dvec3 extent = 0.5 * (hi - lo);
+    double cell = EWALD_NODE_FRACTION * std::min(period.x, std::min(period.y, period.z));
+
+    // with a mesh carrying the long range part only nodes within the cutoff matter, and those as monopoles
+    double cutoff = KERNEL_SCREEN_CUTOFF * parameters.split;
+    if (parameters.split > 0.0) quadrupole = false;
+
+    // walk the tree once for the whole group, opening any node that overlaps the box or is too close to some point of it
+    scratch.list.Clear();
+    scratch.nodes.Clear();
+    scratch.stack.clear();
+    scratch.images.clear();
+    scratch.stack.push_back(0);
+    scratch.images.push_back({ { 0, 0, 0 }, false });
+    while (!scratch.stack.empty()) {
+        int32_t node = scratch.stack.back();
+        PeriodicImage image = scratch.images.back();
+        scratch.stack.pop_back();
+        scratch.images.pop_back();
+        FlatOctNode& current = m_Nodes[node];
+        if (current.count == 0) continue;
+        Oct b = current.boundary;
+        bool nearest = true;
+        if (periodic) {
+            if (!image.fixed && (current.child < 0 || 2.0 * b.radius <= cell)) image = { ImageShift(current.center - middle, period), true };
+            if (!image.fixed) image.shift = ImageShift(glm::dvec3(b.x, b.y, b.z) - middle, period);
+            b.x += image.shift.x;
+            b.y += image.shift.y;
+            b.z += image.shift.z;
+            // a node above the cell size may only stand in for its particles if they all share its image
+            nearest = image.fixed || WithinHalfPeriod(b, middle, extent, period);
+        }
+        if (current.child < 0 && current.count == 1) {
+            glm::dvec3 pos = m_Particles->Position(m_Indices[current.begin]) + image.shift;
+            scratch.list.Push(unitsize * pos.x, unitsize * pos.y, unitsize * pos.z, m_Particles->Mass(m_Indices[current.begin]));
+            continue;
+        }
+        glm::dvec3 center = current.center + image.shift;
+        bool overlaps = lo.x < b.x + b.radius && hi.x >= b.x - b.radius &&
+            lo.y < b.y + b.radius && hi.y >= b.y - b.radius &&
+            lo.z < b.z + b.radius && hi.z >= b.z - b.radius;
+        glm::dvec3 gap = glm::max(glm::max(lo - center, center - hi), glm::dvec3(0.0));
+        double distance = unitsize * std::sqrt(gap.x*gap.x + gap.y*gap.y + gap.z*gap.z);
+        double clearance = 0.0;
+        if (parameters.opening == OpeningCriterion::MINDISTANCE || cutoff > 0.0) {
+            glm::dvec3 low = { b.x - b.radius, b.y - b.radius, b.z - b.radius };
+            glm::dvec3 high = { b.x + b.radius, b.y + b.radius, b.z + b.radius };
+            glm::dvec3 space = glm::max(glm::max(lo - high, low - hi), glm::dvec3(0.0));
+            clearance = unitsize * glm::length(space);
+            if (cutoff > 0.0 && clearance >= cutoff) continue;
+        }
+        if (!overlaps && nearest && parameters.Accept(unitsize * b.radius, current.mass, distance, clearance, reference)) {
+            if (quadrupole) {
+                double q[6];
+                for (int32_t k = 0; k < 6; k++) q[k] = unitsize * unitsize * current.quadrupole[k];
+                scratch.nodes.Push(unitsize * center.x, unitsize * center.y, unitsize * center.z, current.mass, q);
+            } else {
+                scratch.list.Push(unitsize * center.x, unitsize * center.y, unitsize * center.z, current.mass);
+            }
+        } else if (current.child < 0) {
+            // buckets too close to summarize go straight into the direct list
+            for (uint32_t i = current.begin; i < current.begin + current.count; i++) {
+                glm::dvec3 pos = m_Particles->Position(m_Indices[i]) + image.shift;
+                scratch.list.Push(unitsize * pos.x, unitsize * pos.y, unitsize * pos.z, m_Particles->Mass(m_Indices[i]));
+            }
+        } else {
+            for (int32_t i = 0; i < 8; i++) {
+                scratch.stack.push_back(current.child + i);
+                scratch.images.push_back(image.fixed ? image : PeriodicImage{ { 0, 0, 0 }, false });
+            }
+        }
+    }
+
+    // self pairs need no special case, the softened kernel gives them zero force
+    size_t interactions = scratch.list.size + scratch.nodes.size;
+    double softening2 = parameters.softening * parameters.softening;
+    if (cutoff > 0.0)
+        ForceKernel::EvaluateScreened(scratch.list, scratch.x.data(), scratch.y.data(), scratch.z.data(), scratch.ax.data(), scratch.ay.data(), scratch.az.data(), count, softening2, parameters.split);
+    else
+        ForceKernel::Evaluate(scratch.list, scratch.x.data(), scratch.y.data(), scratch.z.data(), scratch.ax.data(), scratch.ay.data(), scratch.az.data(), count, softening2);
+    if (scratch.nodes.size > 0)
+        ForceKernel::EvaluateQuadrupole(scratch.nodes, scratch.x.data(), scratch.y.data(), scratch.z.data(), scratch.ax.data(), scratch.ay.data(), scratch.az.data(), count, softening2);
+    if (periodic && parameters.ewald != nullptr)
+        PeriodicCorrection(scratch, middle, extent, unitsize, parameters);
+    for (size_t i = 0; i < count; i++)
+        m_Particles->SetAcceleration(scratch.targets[i], { scratch.ax[i], scratch.ay[i], scratch.az[i] });
+    return interactions * count;
+}
+
+void FlatOcttree::PeriodicCorrection(GroupScratch &scratch, const glm::dvec3 &middle, const glm::dvec3 &extent, double unitsize, const ForceParameters &parameters) {
+    // the correction is the pull of the images beyond the nearest one, so a node may act as a point once it is
+    // small next to its distance from the second nearest image, seen through the same image the force walk gave it
+    glm::dvec3 period = parameters.period / unitsize;
+    double cell = EWALD_NODE_FRACTION * std::min(period.x, std::min(period.y, period.z));
+    scratch.list.Clear();
+    scratch.stack.clear();
+    scratch.images.clear();
+    scratch.stack.push_back(0);
+    scratch.images.push_back({ { 0, 0, 0 }, false });
+    while (!scratch.stack.empty()) {
+        int32_t node = scratch.stack.back();
+        PeriodicImage image = scratch.images.back();
+        scratch.stack.pop_back();
+        scratch.images.pop_back();
+        FlatOctNode& current = m_Nodes[node];
+        if (current.count == 0) continue;
+        Oct b = current.boundary;
+        if (!image.fixed && (current.child < 0 || 2.0 * b.radius <= cell)) image = { ImageShift(current.center - middle, period), true };
+        if (!image.fixed) image.shift = ImageShift(glm::dvec3(b.x, b.y, b.z) - middle, period);
+        glm::dvec3 center = current.center + image.shift;
+        if (current.child < 0 && current.count == 1) {
+            scratch.list.Push(center.x, center.y, center.z, current.mass);
+            continue;
+        }
+        b.x += image.shift.x;
+        b.y += image.shift.y;
+        b.z += image.shift.z;
+        double distance = std::min(period.x - std::abs(b.x - middle.x) - extent.x,
+            std::min(period.y - std::abs(b.y - middle.y) - extent.y, period.z - std::abs(b.z - middle.z) - extent.z)) - b.radius;
+        bool shared = image.fixed || WithinHalfPeriod(b, middle, glm::dvec3(0.0), period);
+        if (shared && 2.0 * b.radius <= parameters.theta * distance) {
+            scratch.list.Push(center.x, center.y, center.z, current.mass);
+        } else if (current.child < 0) {
+            for (uint32_t i = current.begin; i < current.begin + current.count; i++) {
+                glm::dvec3 pos = m_Particles->Position(m_Indices[i]) + image.shift;
+                scratch.list.Push(pos.x, pos.y, pos.z, m_Particles->Mass(m_Indices[i]));
+            }
+        } else {
+            for (int32_t i = 0; i < 8; i++) {
+                scratch.stack.push_back(current.child + i);
+                scratch.images.push_back(image.fixed ? image : PeriodicImage{ { 0, 0, 0 }, false });
+            }
+        }
+    }
+
+    if (2.0 * std::max(extent.x, std::max(extent.y, extent.z)) > cell) {
+        // a group spread wider than a cell is too wide for the slope, so every target gets its own lookups
+        for (size_t i = 0; i < scratch.targets.size(); i++) {
+            glm::dvec3 pos = m_Particles->Position(scratch.targets[i]);
+            glm::dvec3 a = { 0, 0, 0 };
+            for (size_t j = 0; j < scratch.list.size; j++) {
+                glm::dvec3 d = glm::dvec3(scratch.list.x[j], scratch.list.y[j], scratch.list.z[j]) - pos;
+                a += scratch.list.m[j] * parameters.ewald->Correction(unitsize * d);
+            }
+            scratch.ax[i] += GRAVITY * a.x;
+            scratch.ay[i] += GRAVITY * a.y;
+            scratch.az[i] += GRAVITY * a.z;
+        }
+        return;
+    }
+
+    // otherwise the correction is smooth across the group, so one evaluation at its middle and the slope
+    // there cover every target
+    glm::dvec3 sum = { 0, 0, 0 };
+    glm::dvec3 slope[3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+    glm::dvec3 gradient[3];
+    for (size_t j = 0; j < scratch.list.size; j++) {
+        glm::dvec3 d = glm::dvec3(scratch.list.x[j], scratch.list.y[j], scratch.list.z[j]) - middle;
+        sum += scratch.list.m[j] * parameters.ewald->Correction(unitsize * d, gradient);
+        for (int k = 0; k < 3; k++) slope[k] += scratch.list.m[j] * gradient[k];
+    }
+    for (size_t i = 0; i < scratch.targets.size(); i++) {
+        // a target offset from the middle sees every source offset the other way
+        glm::dvec3 offset = unitsize * (m_Particles->Position(scratch.targets[i]) - middle);
+        glm::dvec3 a = GRAVITY * (sum - offset.x * slope[0] - offset.y * slope[1] - offset.z * slope[2]);
+        scratch.ax[i] += a.x;
+        scratch.ay[i] += a.y;
+        scratch.az[i] += a.z;
+    }
+}
+
+void FlatOcttree::GatherParticles(int32_t node, std::vector<uint32_t>* targets) {
+    FlatOctNode& current = m_Nodes[node];
+    if (current.child < 0) {
+        for (uint32_t i = current.begin; i < current.begin + current.count; i++)
+            targets->push_back(m_Indices[i]);
+    } else {
+        for (int32_t i = 0; i < 8; i++)
+            GatherParticles(current.child + i, targets);
+    }
+}
+
+void FlatOcttree::Compact(int32_t node, uint32_t &next, int32_t bucket) {
+    FlatOctNode& current = m_Nodes[node];
+    uint32_t begin = next;
+
+    // packing makes every subtree contiguous, so one that has thinned out to a bucket's worth becomes a leaf again
+    if (bucket < 0 && current.child >= 0 && current.count <= m_LeafSize) bucket = node;
+    if (current.child < 0) {
+        for (uint32_t i = current.begin; i < current.begin + current.count; i++) {
+            if (bucket >= 0) m_Leaves[m_Indices[i]] = bucket;
+            m_ScratchIndices[next++] = m_Indices[i];
+        }
+    } else {
+        for (int32_t i = 0; i < 8; i++)
+            Compact(current.child + i, next, bucket);
+    }
+    current.begin = begin;
+    if (bucket == node) {
+        current.child = -1;
+        current.count = next - begin;
+    }
+}
+
+int32_t FlatOcttree::Subdivide(int32_t node) {
+    size_t first = m_Size.fetch_add(8);
+    if (first + 8 > m_Nodes.size()) {
+        m_Overflow = true;
+        return -1;
+    }
+    const Oct& b = m_Nodes[node].boundary;
+    double h = b.radius / 2;
+    for (int32_t i = 0; i < 8; i++) {
+        m_Nodes[first + i] = {
+            { 0, 0, 0 }, 0.0,
+            { b.x + (i & 1 ? h : -h), b.y + (i & 2 ? h : -h), b.z + (i & 4 ? h : -h), h },
+            -1, m_Nodes[node].level + 1, 0, 0
+        };
+        m_Parents[first + i] = node;
+    }
+    return (int32_t)first;
+}
+
+bool FlatOcttree::Split(int32_t node) {
+    // children of a sorted range are the contiguous runs of its next morton digit
+    int32_t child = Subdivide(node);
+    if (child < 0) return false;
+    FlatOctNode& current = m_Nodes[node];
+    current.child = child;
+    uint32_t begin = current.begin;
+    uint32_t end = current.begin + current.count;
+    int32_t level = current.level;
+    for (uint32_t o = 0; o < 8; o++) {
+        uint32_t split = (uint32_t)(std::upper_bound(m_Keys.begin() + begin, m_Keys.begin() + end, o,
+            [level](uint32_t digit, uint64_t key) { return digit < Digit(key, level); }) - m_Keys.begin());
+        m_Nodes[child + o].begin = begin;
+        m_Nodes[child + o].count = split - begin;
+        begin = split;
+    }
+    return true;
+}
+
+int32_t FlatOcttree::Octant(const Oct &boundary, int32_t particle) {
+    glm::dvec3 pos = m_Particles->Position(particle);
+    return (pos.x >= boundary.x ? 1 : 0) | (pos.y >= boundary.y ? 2 : 0) | (pos.z >= boundary.z ? 4 : 0);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include "Simulation/Octtree.h"
+#include "Simulation/Kernel.h"
+#include "Simulation/ParticleSoA.h"
+#include <atomic>
+#include <array>
+#include <vector>
+
+#define MORTON_LEVELS 21
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES 6
+#define GROUP_SIZE 32
+#define REFIT_DEPTH_SLACK 2
+#define REFIT_ESCAPE_FRACTION 2
+#define REFIT_PADDING 0.125
+
+struct FlatOctNode {
+    glm::dvec3 center;
+    double mass;
+    Oct boundary;
+    int32_t child;
+    int32_t level;
+    uint32_t begin;
+    uint32_t count;
+    double quadrupole[6];
+};
+
+struct PeriodicImage {
+    glm::dvec3 shift;
+    bool fixed;
+};
+
+struct GroupScratch {
+    InteractionList list;
+    InteractionList nodes;
+    std::vector<int32_t> stack;
+    std::vector<PeriodicImage> images;
+    std::vector<uint32_t> targets;
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+    std::vector<double> ax;
+    std::vector<double> ay;
+    std::vector<double> az;
+};
+
+class FlatOcttree {
+public:
+    void Reset(const Oct &boundary, ParticleSoA* particles);
+    void Grow();
+    void Clear();
+    bool Overflowed() { return m_Overflow; }
+    size_t Size() { return m_Size; }
+    size_t Leaves() { return ((m_Size - 1) / 8) * 7 + 1; }
+    uint32_t LeafSize() { return m_LeafSize; }
+    void SetLeafSize(uint32_t size) { m_LeafSize = size < 1 ? 1 : size; }
+    FlatOctNode& Node(int32_t index) { return m_Nodes[index]; }
+    std::vector<int32_t>& Groups() { return m_Groups; }
+    ParticleSoA* Particles() { return m_Particles; }
+public:
+    void GetLeaves(std::vector<int32_t>* leaves, int32_t node = 0);
+    void GatherParticles(int32_t node, std::vector<uint32_t>* targets);
+public:
+    bool Insert(int32_t particle, int32_t node = 0);
+    void CalculateCenterOfMass(int32_t node);
+    void MarkTop();
+    void SplitTop(std::vector<int32_t>* tasks, size_t target);
+    void CombineTop();
+public:
+    void PrepareSort(size_t chunks);
+    void ComputeKeys(size_t begin, size_t end);
+    void CountDigits(size_t begin, size_t end, size_t chunk);
+    bool PrefixDigits(size_t chunks);
+    void ScatterDigits(size_t begin, size_t end, size_t chunk);
+    void NextRadixPass(bool scattered);
+    void BuildTop(std::vector<int32_t>* tasks, size_t target);
+    bool Build(int32_t node);
+public:
+    void Invalidate() { m_Refittable = false; }
+    void MarkBuilt() { m_Refittable = true; m_Fresh = true; }
+    bool PrepareRefit(const glm::dvec3 &lo, const glm::dvec3 &hi, ParticleSoA* particles);
+    void Evict(size_t begin, size_t end, std::vector<uint32_t>* escaped);
+    bool Reinsert(const std::vector<uint32_t> &escaped);
+public:
+    void CollectGroups(int32_t node = 0);
+    size_t GroupCalculateForce(int32_t group, double unitsize, GroupScratch &scratch, bool quadrupole, const ForceParameters &parameters);
+private:
+    void Compact(int32_t node, uint32_t &next, int32_t bucket);
+    int32_t Subdivide(int32_t node);
+    bool Split(int32_t node);
+    int32_t Octant(const Oct &boundary, int32_t particle);
+    void ResetMoments();
+    void Moments(int32_t node);
+    void PeriodicCorrection(GroupScratch &scratch, const glm::dvec3 &middle, const glm::dvec3 &extent, double unitsize, const ForceParameters &parameters);
+private:
+    std::vector<FlatOctNode> m_Nodes;
+    std::atomic<size_t> m_Size = 0;
+    std::atomic<size_t> m_Slots = 0;
+    std::atomic<bool> m_Overflow = false;
+    ParticleSoA* m_Particles = nullptr;
+    size_t m_Count = 0;
+    uint32_t m_LeafSize = 1;
+private:
+    std::vector<uint32_t> m_Indices;
+    std::vector<uint32_t> m_ScratchIndices;
+    std::vector<uint64_t> m_Keys;
+    std::vector<uint64_t> m_ScratchKeys;
+    std::vector<std::array<size_t, RADIX_BUCKETS>> m_Histograms;
+    size_t m_RadixPass = 0;
+    std::vector<int32_t> m_Groups;
+private:
+    bool m_Refittable = false;
+    bool m_Fresh = false;
+    std::atomic<int32_t> m_Depth = 0;
+    std::atomic<size_t> m_Empty = 0;
+    int32_t m_BuiltDepth = 0;
+    size_t m_BuiltEmpty = 0;
+    size_t m_BuiltSize = 0;
+    std::vector<int32_t> m_Leaves;
+    std::vector<int32_t> m_Parents;
+    std::vector<int32_t> m_Top;
+};
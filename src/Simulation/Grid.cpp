@@ -1 +1,8 @@
 #include "Grid.h"
+
+void Grid::SetResolution(uint32_t resolution) {
+	// the mesh transforms are radix 2, so round up to the next power of two
+	uint32_t cells = GRID_MIN_RESOLUTION;
+	while (cells < resolution && cells < GRID_MAX_RESOLUTION) cells <<= 1;
+	m_Resolution = cells;
+}
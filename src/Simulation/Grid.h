@@ -1,8 +1,22 @@
 #pragma once
 #include "Simulation/Resource.h"
+#include <cstdint>
+
+#define GRID_RESOLUTION 64
+#define GRID_MIN_RESOLUTION 8
+#define GRID_MAX_RESOLUTION 512
+#define GRID_SPLIT 1.25
 
 class Grid : public Resource {
 public:
 	Grid() { Initialize(); }
 	Grid(uint64_t id) { Initialize(id); }
+public:
+	uint32_t Resolution() { return m_Resolution; }
+	void SetResolution(uint32_t resolution);
+	double Split() { return m_Split; }
+	void SetSplit(double split) { m_Split = split > 0.0 ? split : GRID_SPLIT; }
+private:
+	uint32_t m_Resolution = GRID_RESOLUTION;
+	double m_Split = GRID_SPLIT;
 };
@@ -0,0 +1,222 @@
+#include "Integrator.h"
+#include <algorithm>
+#include <cmath>
+
+// runge kutta fehlberg 4(5) tableau, the fifth order solution is propagated and the fourth order one only measures the error
+static const double RKF45_A[RKF45_STAGES][RKF45_STAGES - 1] = {
+    { 0.0, 0.0, 0.0, 0.0, 0.0 },
+    { 1.0 / 4.0, 0.0, 0.0, 0.0, 0.0 },
+    { 3.0 / 32.0, 9.0 / 32.0, 0.0, 0.0, 0.0 },
+    { 1932.0 / 2197.0, -7200.0 / 2197.0, 7296.0 / 2197.0, 0.0, 0.0 },
+    { 439.0 / 216.0, -8.0, 3680.0 / 513.0, -845.0 / 4104.0, 0.0 },
+    { -8.0 / 27.0, 2.0, -3544.0 / 2565.0, 1859.0 / 4104.0, -11.0 / 40.0 },
+};
+static const double RKF45_B5[RKF45_STAGES] = { 16.0 / 135.0, 0.0, 6656.0 / 12825.0, 28561.0 / 56430.0, -9.0 / 50.0, 2.0 / 55.0 };
+static const double RKF45_B4[RKF45_STAGES] = { 25.0 / 216.0, 0.0, 1408.0 / 2565.0, 2197.0 / 4104.0, -1.0 / 5.0, 0.0 };
+
+// leapfrog stage weights of yoshida's symmetric compositions, the outer weights are mirrored around the middle one
+static const double YOSHIDA4_W[2] = { 1.3512071919596578, -1.7024143839193153 };
+static const double YOSHIDA6_W[4] = { 0.784513610477560, 0.235573213359357, -1.17767998417887, 1.31518632068391 };
+
+// omelyan, mryglod and folk's optimized forest ruth like scheme in its kick first form
+#define PEFRL_XI 0.1786178958448091
+#define PEFRL_LAMBDA -0.2123418310626054
+#define PEFRL_CHI -0.06626458266981849
+
+void StepError::Merge(const StepError &other) {
+    ratio = std::max(ratio, other.ratio);
+}
+
+void Integrator::Prepare(ParticleSoA* particles, double unitsize, bool adaptive) {
+    m_Particles = particles;
+    m_UnitSize = unitsize;
+    size_t count = adaptive ? particles->Size() : 0;
+    m_Base.resize(6);
+    m_Slopes.resize(RKF45_STAGES * 6);
+    for (AlignedDoubles& array : m_Base) array.assign(count, 0.0);
+    for (AlignedDoubles& array : m_Slopes) array.assign(count, 0.0);
+}
+
+bool Integrator::Moves() {
+    return m_Pass == IntegratorPass::EULER || m_Pass == IntegratorPass::DRIFT || m_Pass == IntegratorPass::STAGE ||
+        m_Pass == IntegratorPass::COMBINE || m_Pass == IntegratorPass::RESTORE;
+}
+
+void Integrator::Run(size_t begin, size_t end, StepError* error) {
+    // state is position then velocity, its derivative is velocity then acceleration over the unit size
+    ParticleSoA& s = *m_Particles;
+    double* y[6] = { s.px.data(), s.py.data(), s.pz.data(), s.vx.data(), s.vy.data(), s.vz.data() };
+    double* a[3] = { s.ax.data(), s.ay.data(), s.az.data() };
+    double h = m_Step;
+    switch (m_Pass) {
+        case IntegratorPass::EULER:
+            for (size_t c = 0; c < 3; c++) {
+                for (size_t i = begin; i < end; i++) {
+                    y[c][i] += h * y[c + 3][i];
+                    y[c + 3][i] += (h * a[c][i]) / m_UnitSize;
+                }
+            }
+            break;
+        case IntegratorPass::KICK:
+            for (size_t c = 0; c < 3; c++)
+                for (size_t i = begin; i < end; i++) y[c + 3][i] += (h * a[c][i]) / m_UnitSize;
+            break;
+        case IntegratorPass::DRIFT:
+            for (size_t c = 0; c < 3; c++)
+                for (size_t i = begin; i < end; i++) y[c][i] += h * y[c + 3][i];
+            break;
+        case IntegratorPass::SAVE:
+            for (size_t c = 0; c < 6; c++)
+                std::copy(y[c] + begin, y[c] + end, m_Base[c].begin() + begin);
+            break;
+        case IntegratorPass::RECORD:
+            for (size_t c = 0; c < 6; c++) {
+                double* slope = m_Slopes[m_Stage * 6 + c].data();
+                if (c < 3)
+                    std::copy(y[c + 3] + begin, y[c + 3] + end, slope + begin);
+                else
+                    for (size_t i = begin; i < end; i++) slope[i] = a[c - 3][i] / m_UnitSize;
+            }
+            break;
+        case IntegratorPass::STAGE:
+            for (size_t c = 0; c < 6; c++) {
+                for (size_t i = begin; i < end; i++) {
+                    double sum = 0.0;
+                    for (size_t j = 0; j < m_Stage; j++) sum += RKF45_A[m_Stage][j] * m_Slopes[j * 6 + c][i];
+                    y[c][i] = m_Base[c][i] + h * sum;
+                }
+            }
+            break;
+        case IntegratorPass::COMBINE:
+            // each component is held to its own absolute plus relative tolerance, so a shifted frame sees the same errors
+            for (size_t c = 0; c < 6; c++) {
+                double absolute = m_Absolute[c < 3 ? 0 : 1];
+                double worst = 0.0;
+                for (size_t i = begin; i < end; i++) {
+                    double fifth = 0.0;
+                    double fourth = 0.0;
+                    for (size_t j = 0; j < RKF45_STAGES; j++) {
+                        fifth += RKF45_B5[j] * m_Slopes[j * 6 + c][i];
+                        fourth += RKF45_B4[j] * m_Slopes[j * 6 + c][i];
+                    }
+                    y[c][i] = m_Base[c][i] + h * fifth;
+                    double scale = absolute + m_Relative * std::max(std::abs(y[c][i]), std::abs(m_Base[c][i]));
+                    if (scale > 0.0) worst = std::max(worst, std::abs(h * (fifth - fourth)) / scale);
+                }
+                error->ratio = std::max(error->ratio, worst);
+            }
+            break;
+        case IntegratorPass::RESTORE:
+            for (size_t c = 0; c < 6; c++)
+                std::copy(m_Base[c].begin() + begin, m_Base[c].begin() + end, y[c] + begin);
+            break;
+        case IntegratorPass::OPEN:
+            for (size_t k = begin; k < end; k++) {
+                // pick the level from how soon the particle turns or falls through a softening length, then start its step
+                uint32_t i = m_Active[k];
+                double g = std::sqrt(s.ax[i] * s.ax[i] + s.ay[i] * s.ay[i] + s.az[i] * s.az[i]) / m_UnitSize;
+                double v = std::sqrt(s.vx[i] * s.vx[i] + s.vy[i] * s.vy[i] + s.vz[i] * s.vz[i]);
+                uint32_t level = 0;
+                if (g > 0.0) {
+                    double span = BLOCK_ETA * (v / g + std::sqrt(m_Softening / g));
+                    // a pull that swings quickly, like a close pair passing by, needs short steps even when it is weak
+                    if (m_Ends[i] > 0) {
+                        double dx = s.ax[i] - m_LastX[i];
+                        double dy = s.ay[i] - m_LastY[i];
+                        double dz = s.az[i] - m_LastZ[i];
+                        double jerk = std::sqrt(dx * dx + dy * dy + dz * dz) / (m_UnitSize * std::ldexp(h, -(int)m_Levels[i]));
+                        if (jerk > 0.0) span = std::min(span, BLOCK_ETA * g / jerk);
+                    }
+                    if (span < h) level = (uint32_t)std::min((double)BLOCK_LEVELS, std::ceil(std::log2(h / span)));
+                }
+                m_LastX[i] = s.ax[i];
+                m_LastY[i] = s.ay[i];
+                m_LastZ[i] = s.az[i];
+                // a step can only start where its level lines up with the block grid
+                while (level < BLOCK_LEVELS && m_Tick % (BLOCK_TICKS >> level) != 0) level++;
+                m_Levels[i] = (uint8_t)level;
+                m_Ends[i] = m_Tick + (BLOCK_TICKS >> level);
+                double kick = 0.5 * std::ldexp(h, -(int)level) / m_UnitSize;
+                s.vx[i] += kick * s.ax[i];
+                s.vy[i] += kick * s.ay[i];
+                s.vz[i] += kick * s.az[i];
+            }
+            break;
+        case IntegratorPass::CLOSE:
+            for (size_t k = begin; k < end; k++) {
+                uint32_t i = m_Active[k];
+                double kick = 0.5 * std::ldexp(h, -(int)m_Levels[i]) / m_UnitSize;
+                s.vx[i] += kick * s.ax[i];
+                s.vy[i] += kick * s.ay[i];
+                s.vz[i] += kick * s.az[i];
+            }
+            break;
+    }
+}
+
+void Integrator::Compose(Composition scheme) {
+    // every scheme is written kick first and kick last, so the closing kick's forces open the next step
+    std::vector<double> weights;
+    switch (scheme) {
+        case Composition::LEAPFROG:
+            weights = { 1.0 };
+            break;
+        case Composition::FORESTRUTH:
+            m_Kicks = { PEFRL_XI, PEFRL_CHI, 1.0 - 2.0 * (PEFRL_CHI + PEFRL_XI), PEFRL_CHI, PEFRL_XI };
+            m_Drifts = { 0.5 * (1.0 - 2.0 * PEFRL_LAMBDA), PEFRL_LAMBDA, PEFRL_LAMBDA, 0.5 * (1.0 - 2.0 * PEFRL_LAMBDA) };
+            return;
+        case Composition::YOSHIDA4:
+            weights = { YOSHIDA4_W[0], YOSHIDA4_W[1], YOSHIDA4_W[0] };
+            break;
+        case Composition::YOSHIDA6:
+            weights = { YOSHIDA6_W[0], YOSHIDA6_W[1], YOSHIDA6_W[2], YOSHIDA6_W[3], YOSHIDA6_W[2], YOSHIDA6_W[1], YOSHIDA6_W[0] };
+            break;
+    }
+    // chain the leapfrog stages, merging the closing half kick of one with the opening half kick of the next
+    m_Drifts = weights;
+    m_Kicks.assign(weights.size() + 1, 0.0);
+    for (size_t k = 0; k < weights.size(); k++) {
+        m_Kicks[k] += 0.5 * weights[k];
+        m_Kicks[k + 1] += 0.5 * weights[k];
+    }
+}
+
+void Integrator::PrepareBlocks(double softening) {
+    m_Softening = softening;
+    m_Tick = 0;
+    m_Levels.assign(m_Particles->Size(), 0);
+    m_Ends.assign(m_Particles->Size(), 0);
+    m_LastX.assign(m_Particles->Size(), 0.0);
+    m_LastY.assign(m_Particles->Size(), 0.0);
+    m_LastZ.assign(m_Particles->Size(), 0.0);
+}
+
+uint64_t Integrator::Advance() {
+    // every step ends on the block grid, so the next sync point is the earliest end and the particles ending there are active
+    uint64_t next = BLOCK_TICKS;
+    for (uint64_t end : m_Ends) next = std::min(next, end);
+    m_Active.clear();
+    for (size_t i = 0; i < m_Ends.size(); i++)
+        if (m_Ends[i] == next) m_Active.push_back((uint32_t)i);
+    return next;
+}
+
+void Integrator::ActivateAll() {
+    m_Active.resize(m_Particles->Size());
+    for (size_t i = 0; i < m_Active.size(); i++) m_Active[i] = (uint32_t)i;
+}
+
+uint32_t Integrator::FinestLevel() {
+    uint32_t finest = 0;
+    for (uint8_t level : m_Levels) finest = std::max(finest, (uint32_t)level);
+    return finest;
+}
+
+double Integrator::Adapt(const StepError &error, double minimum, bool* accepted) {
+    // the worst error against its tolerance decides, then the step follows the usual fifth root rule
+    double ratio = error.ratio;
+    // tree forces are only approximate, so below the minimum step the error estimate is mostly noise and the step is taken anyway
+    *accepted = ratio <= 1.0 || m_Step <= minimum;
+    double factor = ratio > 0.0 ? 0.9 * std::pow(ratio, -0.2) : 5.0;
+    return std::max(minimum, m_Step * std::min(5.0, std::max(0.2, factor)));
+}
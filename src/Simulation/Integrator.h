@@ -0,0 +1,81 @@
+#pragma once
+#include "Simulation/ParticleSoA.h"
+#include <cstdint>
+#include <vector>
+
+#define RKF45_STAGES 6
+#define RKF45_MIN_DIVISIONS 4096
+#define BLOCK_LEVELS 20
+#define BLOCK_TICKS ((uint64_t)1 << BLOCK_LEVELS)
+#define BLOCK_ETA 0.02
+
+enum class IntegratorPass {
+    EULER,
+    KICK,
+    DRIFT,
+    SAVE,
+    STAGE,
+    RECORD,
+    COMBINE,
+    RESTORE,
+    OPEN,
+    CLOSE,
+};
+
+enum class Composition {
+    LEAPFROG,
+    FORESTRUTH,
+    YOSHIDA4,
+    YOSHIDA6,
+};
+
+struct StepError {
+    double ratio;
+    void Reset() { ratio = 0.0; }
+    void Merge(const StepError &other);
+};
+
+class Integrator {
+public:
+    void Prepare(ParticleSoA* particles, double unitsize, bool adaptive);
+    void SetTolerance(double relative, double position, double velocity) { m_Relative = relative; m_Absolute[0] = position; m_Absolute[1] = velocity; }
+    void Set(IntegratorPass pass, double step, size_t stage = 0) { m_Pass = pass; m_Step = step; m_Stage = stage; }
+    bool Moves();
+    void Run(size_t begin, size_t end, StepError* error);
+    double Adapt(const StepError &error, double minimum, bool* accepted);
+public:
+    void Compose(Composition scheme);
+    size_t Drifts() { return m_Drifts.size(); }
+    double Drift(size_t k) { return m_Drifts[k]; }
+    double Kick(size_t k) { return m_Kicks[k]; }
+public:
+    void PrepareBlocks(double softening);
+    void SetTick(uint64_t tick) { m_Tick = tick; }
+    uint64_t Advance();
+    void ActivateAll();
+    std::vector<uint32_t>& Active() { return m_Active; }
+    bool Partial() { return m_Active.size() < m_Particles->Size(); }
+    bool IsActive(uint32_t particle) { return m_Ends[particle] == m_Tick; }
+    size_t Targets() { return m_Pass == IntegratorPass::OPEN || m_Pass == IntegratorPass::CLOSE ? m_Active.size() : m_Particles->Size(); }
+    uint32_t FinestLevel();
+private:
+    ParticleSoA* m_Particles = nullptr;
+    double m_UnitSize = 1.0;
+    IntegratorPass m_Pass = IntegratorPass::KICK;
+    double m_Step = 0.0;
+    size_t m_Stage = 0;
+    std::vector<AlignedDoubles> m_Base;
+    std::vector<AlignedDoubles> m_Slopes;
+    double m_Relative = 0.0;
+    double m_Absolute[2] = { 0.0, 0.0 };
+    std::vector<double> m_Drifts;
+    std::vector<double> m_Kicks;
+    double m_Softening = 0.0;
+    uint64_t m_Tick = 0;
+    std::vector<uint8_t> m_Levels;
+    std::vector<uint64_t> m_Ends;
+    std::vector<double> m_LastX;
+    std::vector<double> m_LastY;
+    std::vector<double> m_LastZ;
+    std::vector<uint32_t> m_Active;
+};
@@ -0,0 +1,128 @@
+#include "Kernel.h"
+#include "Simulation/Octtree.h"
+#include <cmath>
+#include <vector>
+#if KERNEL_DISPATCH && defined(_WIN32)
+#include <intrin.h>
+#endif
+
+static void Pad(InteractionList& list, bool quadrupole) {
+	// pad with massless entries so the vector loops never need a remainder
+	static const double zero[6] = { 0, 0, 0, 0, 0, 0 };
+	while (list.size % KERNEL_WIDTH != 0) {
+		if (quadrupole) list.Push(0.0, 0.0, 0.0, 0.0, zero);
+		else list.Push(0.0, 0.0, 0.0, 0.0);
+	}
+}
+
+#if KERNEL_DISPATCH
+#if defined(_WIN32)
+#if defined(__clang__)
+__attribute__((target("xsave")))
+#endif
+static bool Supports(int isa) {
+	// the cpu has to have the instructions and the os has to save the wider registers across switches
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	if (((info[2] >> 27) & 1) == 0) return false;
+	bool fma = ((info[2] >> 12) & 1) != 0;
+	unsigned long long state = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	if (isa == KERNEL_ISA_AVX512) return (state & 0xe6) == 0xe6 && ((info[1] >> 16) & 1) != 0;
+	return (state & 0x6) == 0x6 && fma && ((info[1] >> 5) & 1) != 0;
+}
+#else
+static bool Supports(int isa) {
+	__builtin_cpu_init();
+	if (isa == KERNEL_ISA_AVX512) return __builtin_cpu_supports("avx512f");
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+#endif
+
+static const KernelSet& Kernels() {
+	// picked once, the widest copy this cpu can run
+	static const KernelSet& kernels = []() -> const KernelSet& {
+#if KERNEL_DISPATCH
+		if (Supports(KERNEL_ISA_AVX512)) return AVX512Kernels;
+		if (Supports(KERNEL_ISA_AVX2)) return AVX2Kernels;
+#endif
+		return ScalarKernels;
+	}();
+	return kernels;
+}
+
+void ForceKernel::Accumulate(const double* sx, const double* sy, const double* sz, const double* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, const double* period) {
+	Kernels().accumulate(sx, sy, sz, sm, sources, x, y, z, ax, ay, az, count, softening2, period);
+}
+
+void ForceKernel::AccumulateMixed(const double* sx, const double* sy, const double* sz, const float* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* period) {
+	Kernels().accumulate_mixed(sx, sy, sz, sm, sources, x, y, z, ax, ay, az, count, softening2, gain, period);
+}
+
+void ForceKernel::AccumulatePairs(const double* sx, const double* sy, const double* sz, const double* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const double* m, double* ax, double* ay, double* az, size_t count, double softening2, const double* period) {
+	Kernels().accumulate_pairs(sx, sy, sz, sm, sax, say, saz, sources, x, y, z, m, ax, ay, az, count, softening2, period);
+}
+
+void ForceKernel::AccumulatePairsMixed(const double* sx, const double* sy, const double* sz, const float* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const float* m, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* period) {
+	Kernels().accumulate_pairs_mixed(sx, sy, sz, sm, sax, say, saz, sources, x, y, z, m, ax, ay, az, count, softening2, gain, period);
+}
+
+void ForceKernel::Evaluate(InteractionList& list, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, const double* period) {
+	Pad(list, false);
+	Accumulate(list.x.data(), list.y.data(), list.z.data(), list.m.data(), list.size, x, y, z, ax, ay, az, count, softening2, period);
+}
+
+void ForceKernel::EvaluateQuadrupole(InteractionList& list, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2) {
+	Pad(list, true);
+	Kernels().evaluate_quadrupole(list, x, y, z, ax, ay, az, count, softening2);
+}
+
+static const std::vector<double>& ScreenTable() {
+	// what a mesh smoothed over the split scale leaves of the pull, erfc(u) + 2u / sqrt(pi) exp(-u^2) at u = r / 2 split,
+	// sampled out to the cutoff in units of the split
+	static const std::vector<double> table = []() {
+		std::vector<double> samples(KERNEL_SCREEN_SAMPLES + 1);
+		for (size_t k = 0; k <= KERNEL_SCREEN_SAMPLES; k++) {
+			double u = 0.5 * KERNEL_SCREEN_CUTOFF * (double)k / (double)KERNEL_SCREEN_SAMPLES;
+			samples[k] = std::erfc(u) + 2.0 * u / std::sqrt(3.14159265358979323846) * std::exp(-u * u);
+		}
+		return samples;
+	}();
+	return table;
+}
+
+void ForceKernel::EvaluateScreened(InteractionList& list, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, double split) {
+	// short range half of a tree and mesh split, scalar since every pair needs a table lookup, pairs past the cutoff add nothing
+	const std::vector<double>& table = ScreenTable();
+	double scale = (double)KERNEL_SCREEN_SAMPLES / (KERNEL_SCREEN_CUTOFF * split);
+	for (size_t i = 0; i < count; i++) {
+		double sx = 0.0;
+		double sy = 0.0;
+		double sz = 0.0;
+		for (size_t j = 0; j < list.size; j++) {
+			double dx = list.x[j] - x[i];
+			double dy = list.y[j] - y[i];
+			double dz = list.z[j] - z[i];
+			double r2 = dx * dx + dy * dy + dz * dz + softening2;
+			double r = std::sqrt(r2);
+			double q = r * scale;
+			if (q >= (double)KERNEL_SCREEN_SAMPLES) continue;
+			size_t k = (size_t)q;
+			double screen = table[k] + (q - (double)k) * (table[k + 1] - table[k]);
+			double w = list.m[j] * screen / (r2 * r);
+			sx += w * dx;
+			sy += w * dy;
+			sz += w * dz;
+		}
+		ax[i] += GRAVITY * sx;
+		ay[i] += GRAVITY * sy;
+		az[i] += GRAVITY * sz;
+	}
+}
+
+const char* ForceKernel::InstructionSet() {
+	return Kernels().name;
+}
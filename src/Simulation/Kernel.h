@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#define KERNEL_WIDTH 8
+#define KERNEL_SCREEN_CUTOFF 4.5
+#define KERNEL_SCREEN_SAMPLES 1024
+#define KERNEL_ISA_SCALAR 0
+#define KERNEL_ISA_AVX2 1
+#define KERNEL_ISA_AVX512 2
+
+// the vector copies are built on x86 compilers that can target instruction sets per function
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+#define KERNEL_DISPATCH 1
+#else
+#define KERNEL_DISPATCH 0
+#endif
+
+struct InteractionList {
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<double> z;
+	std::vector<double> m;
+	std::vector<double> q[6];
+	size_t size = 0;
+	void Clear() { size = 0; }
+	void Push(double px, double py, double pz, double mass) {
+		if (size == x.size()) Reserve(size == 0 ? 256 : size * 2, false);
+		x[size] = px;
+		y[size] = py;
+		z[size] = pz;
+		m[size] = mass;
+		size++;
+	}
+	void Push(double px, double py, double pz, double mass, const double* quadrupole) {
+		if (size == x.size() || q[0].size() < x.size()) Reserve(size == x.size() ? (size == 0 ? 256 : size * 2) : x.size(), true);
+		for (size_t k = 0; k < 6; k++) q[k][size] = quadrupole[k];
+		Push(px, py, pz, mass);
+	}
+	void Reserve(size_t capacity, bool quadrupole) {
+		x.resize(capacity);
+		y.resize(capacity);
+		z.resize(capacity);
+		m.resize(capacity);
+		if (quadrupole)
+			for (size_t k = 0; k < 6; k++) q[k].resize(capacity);
+	}
+};
+
+// one compiled copy of the vector kernels, sources must already be padded to the kernel width
+struct KernelSet {
+	const char* name;
+	void (*accumulate)(const double* sx, const double* sy, const double* sz, const double* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, const double* period);
+	void (*accumulate_mixed)(const double* sx, const double* sy, const double* sz, const float* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* period);
+	void (*accumulate_pairs)(const double* sx, const double* sy, const double* sz, const double* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const double* m, double* ax, double* ay, double* az, size_t count, double softening2, const double* period);
+	void (*accumulate_pairs_mixed)(const double* sx, const double* sy, const double* sz, const float* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const float* m, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* period);
+	void (*evaluate_quadrupole)(InteractionList& list, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2);
+};
+
+extern const KernelSet ScalarKernels;
+#if KERNEL_DISPATCH
+extern const KernelSet AVX2Kernels;
+extern const KernelSet AVX512Kernels;
+#endif
+
+// runs every kernel through the widest copy the cpu supports, picked on first use
+class ForceKernel {
+public:
+	static void Accumulate(const double* sx, const double* sy, const double* sz, const double* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, const double* period = nullptr);
+	static void AccumulateMixed(const double* sx, const double* sy, const double* sz, const float* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* period = nullptr);
+	static void AccumulatePairs(const double* sx, const double* sy, const double* sz, const double* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const double* m, double* ax, double* ay, double* az, size_t count, double softening2, const double* period = nullptr);
+	static void AccumulatePairsMixed(const double* sx, const double* sy, const double* sz, const float* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const float* m, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* period = nullptr);
+	static void Evaluate(InteractionList& list, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, const double* period = nullptr);
+	static void EvaluateQuadrupole(InteractionList& list, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2);
+	static void EvaluateScreened(InteractionList& list, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, double split);
+	static const char* InstructionSet();
+};
@@ -0,0 +1,7 @@
+#include "Simulation/Kernel.h"
+#if KERNEL_DISPATCH
+#define KERNEL_ISA KERNEL_ISA_AVX2
+#include "Simulation/KernelBody.h"
+
+const KernelSet AVX2Kernels = { "AVX2", Accumulate, AccumulateMixed, AccumulatePairs, AccumulatePairsMixed, EvaluateQuadrupole };
+#endif
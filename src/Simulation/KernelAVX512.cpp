@@ -0,0 +1,7 @@
+#include "Simulation/Kernel.h"
+#if KERNEL_DISPATCH
+#define KERNEL_ISA KERNEL_ISA_AVX512
+#include "Simulation/KernelBody.h"
+
+const KernelSet AVX512Kernels = { "AVX-512", Accumulate, AccumulateMixed, AccumulatePairs, AccumulatePairsMixed, EvaluateQuadrupole };
+#endif
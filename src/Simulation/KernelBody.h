@@ -0,0 +1,387 @@
+#pragma once
+#include "Simulation/Kernel.h"
+#include "Simulation/Octtree.h"
+#include <cmath>
+#if KERNEL_ISA != KERNEL_ISA_SCALAR
+#include <immintrin.h>
+#endif
+
+// the vector kernels, included once by each of the Kernel*.cpp files with KERNEL_ISA set to the instruction set
+// that copy is compiled for. every function here gets the matching target, so the copies sit side by side in one
+// build whatever the compiler flags and ForceKernel picks the one the cpu runs
+#ifndef KERNEL_ISA
+#error "define KERNEL_ISA before including the kernel body"
+#endif
+
+#if KERNEL_ISA == KERNEL_ISA_AVX512
+#define KERNEL_TARGET
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,avx2,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma")
+#endif
+#elif KERNEL_ISA == KERNEL_ISA_AVX2
+#define KERNEL_TARGET
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+#endif
+
+// thin wrappers so each kernel is written once for every instruction set
+#if KERNEL_ISA == KERNEL_ISA_AVX512
+typedef __m512d vdouble;
+#define VWIDTH 8
+static inline vdouble VLoad(const double* p) { return _mm512_loadu_pd(p); }
+static inline void VStore(double* p, vdouble a) { _mm512_storeu_pd(p, a); }
+static inline vdouble VSet(double v) { return _mm512_set1_pd(v); }
+static inline vdouble VAdd(vdouble a, vdouble b) { return _mm512_add_pd(a, b); }
+static inline vdouble VSub(vdouble a, vdouble b) { return _mm512_sub_pd(a, b); }
+static inline vdouble VMul(vdouble a, vdouble b) { return _mm512_mul_pd(a, b); }
+static inline vdouble VFma(vdouble a, vdouble b, vdouble c) { return _mm512_fmadd_pd(a, b, c); }
+static inline vdouble VRound(vdouble a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+static inline double VSum(vdouble a) { return _mm512_reduce_add_pd(a); }
+static inline vdouble VRsqrt(vdouble r2) {
+	vdouble inv = _mm512_rsqrt14_pd(r2);
+	vdouble hr2 = VMul(VSet(0.5), r2);
+	inv = VMul(inv, _mm512_fnmadd_pd(hr2, VMul(inv, inv), VSet(1.5)));
+	inv = VMul(inv, _mm512_fnmadd_pd(hr2, VMul(inv, inv), VSet(1.5)));
+	return inv;
+}
+typedef __m512 vfloat;
+#define VFWIDTH 16
+static inline vfloat VFLoad(const float* p) { return _mm512_loadu_ps(p); }
+static inline vfloat VFSet(float v) { return _mm512_set1_ps(v); }
+static inline vfloat VFMul(vfloat a, vfloat b) { return _mm512_mul_ps(a, b); }
+static inline vfloat VFFma(vfloat a, vfloat b, vfloat c) { return _mm512_fmadd_ps(a, b, c); }
+static inline vfloat VFRsqrt(vfloat r2) {
+	vfloat inv = _mm512_rsqrt14_ps(r2);
+	return VFMul(inv, _mm512_fnmadd_ps(VFMul(VFSet(0.5f), r2), VFMul(inv, inv), VFSet(1.5f)));
+}
+static inline void VWiden(vfloat a, vdouble* lo, vdouble* hi) {
+	*lo = _mm512_cvtps_pd(_mm512_castps512_ps256(a));
+	*hi = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1)));
+}
+static inline vfloat VNarrow(vdouble lo, vdouble hi) {
+	return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(_mm512_cvtpd_ps(lo))), _mm256_castps_pd(_mm512_cvtpd_ps(hi)), 1));
+}
+#elif KERNEL_ISA == KERNEL_ISA_AVX2
+typedef __m256d vdouble;
+#define VWIDTH 4
+static inline vdouble VLoad(const double* p) { return _mm256_loadu_pd(p); }
+static inline void VStore(double* p, vdouble a) { _mm256_storeu_pd(p, a); }
+static inline vdouble VSet(double v) { return _mm256_set1_pd(v); }
+static inline vdouble VAdd(vdouble a, vdouble b) { return _mm256_add_pd(a, b); }
+static inline vdouble VSub(vdouble a, vdouble b) { return _mm256_sub_pd(a, b); }
+static inline vdouble VMul(vdouble a, vdouble b) { return _mm256_mul_pd(a, b); }
+static inline vdouble VFma(vdouble a, vdouble b, vdouble c) { return _mm256_fmadd_pd(a, b, c); }
+static inline vdouble VRound(vdouble a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+static inline double VSum(vdouble a) {
+	double r[4];
+	_mm256_storeu_pd(r, a);
+	return r[0] + r[1] + r[2] + r[3];
+}
+static inline vdouble VRsqrt(vdouble r2) {
+	// there is no double precision rsqrt on avx2, so seed from the exponent bits over the full double range
+	vdouble inv = _mm256_castsi256_pd(_mm256_sub_epi64(_mm256_set1_epi64x(0x5fe6eb50c7b537a9), _mm256_srli_epi64(_mm256_castpd_si256(r2), 1)));
+	vdouble hr2 = VMul(VSet(0.5), r2);
+	for (int i = 0; i < 4; i++)
+		inv = VMul(inv, _mm256_fnmadd_pd(hr2, VMul(inv, inv), VSet(1.5)));
+	return inv;
+}
+typedef __m256 vfloat;
+#define VFWIDTH 8
+static inline vfloat VFLoad(const float* p) { return _mm256_loadu_ps(p); }
+static inline vfloat VFSet(float v) { return _mm256_set1_ps(v); }
+static inline vfloat VFMul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat VFFma(vfloat a, vfloat b, vfloat c) { return _mm256_fmadd_ps(a, b, c); }
+static inline vfloat VFRsqrt(vfloat r2) {
+	vfloat inv = _mm256_rsqrt_ps(r2);
+	return VFMul(inv, _mm256_fnmadd_ps(VFMul(VFSet(0.5f), r2), VFMul(inv, inv), VFSet(1.5f)));
+}
+static inline void VWiden(vfloat a, vdouble* lo, vdouble* hi) {
+	*lo = _mm256_cvtps_pd(_mm256_castps256_ps128(a));
+	*hi = _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1));
+}
+static inline vfloat VNarrow(vdouble lo, vdouble hi) {
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1);
+}
+#else
+typedef double vdouble;
+#define VWIDTH 1
+static inline vdouble VLoad(const double* p) { return *p; }
+static inline void VStore(double* p, vdouble a) { *p = a; }
+static inline vdouble VSet(double v) { return v; }
+static inline vdouble VAdd(vdouble a, vdouble b) { return a + b; }
+static inline vdouble VSub(vdouble a, vdouble b) { return a - b; }
+static inline vdouble VMul(vdouble a, vdouble b) { return a * b; }
+static inline vdouble VFma(vdouble a, vdouble b, vdouble c) { return (a * b) + c; }
+static inline vdouble VRound(vdouble a) { return std::nearbyint(a); }
+static inline double VSum(vdouble a) { return a; }
+static inline vdouble VRsqrt(vdouble r2) { return 1.0 / std::sqrt(r2); }
+// the scalar fallback pairs each float with two doubles, the second one always zero and never narrowed
+typedef float vfloat;
+#define VFWIDTH 1
+static inline vfloat VFLoad(const float* p) { return *p; }
+static inline vfloat VFSet(float v) { return v; }
+static inline vfloat VFMul(vfloat a, vfloat b) { return a * b; }
+static inline vfloat VFFma(vfloat a, vfloat b, vfloat c) { return (a * b) + c; }
+static inline vfloat VFRsqrt(vfloat r2) { return 1.0f / std::sqrt(r2); }
+static inline void VWiden(vfloat a, vdouble* lo, vdouble* hi) {
+	*lo = a;
+	*hi = 0.0;
+}
+static inline vfloat VNarrow(vdouble lo, vdouble hi) {
+	(void)hi;
+	return (float)lo;
+}
+#endif
+
+// separations folded onto their nearest periodic image, compiled away for open boundaries
+template<bool Periodic>
+struct NearestImage {
+	vdouble period[3];
+	vdouble inverse[3];
+	NearestImage(const double* box) {
+		for (int k = 0; k < 3; k++) {
+			period[k] = VSet(Periodic ? box[k] : 0.0);
+			inverse[k] = VSet(Periodic ? 1.0 / box[k] : 0.0);
+		}
+	}
+	vdouble Wrap(vdouble d, int k) const { return Periodic ? VSub(d, VMul(period[k], VRound(VMul(d, inverse[k])))) : d; }
+};
+
+// a source block minus one target, taken in double and folded before it is narrowed, so pairs far from the origin
+// or across a periodic edge keep their separation
+template<bool Periodic>
+static inline vfloat Separation(const double* s, vdouble p, const NearestImage<Periodic>& image, int k) {
+	vdouble lo = image.Wrap(VSub(VLoad(s), p), k);
+	vdouble hi = VFWIDTH > 1 ? image.Wrap(VSub(VLoad(s + VWIDTH), p), k) : lo;
+	return VNarrow(lo, hi);
+}
+
+template<bool Periodic>
+static void AccumulateKernel(const double* sx, const double* sy, const double* sz, const double* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, const double* box) {
+	NearestImage<Periodic> image(box);
+	// sources must be a multiple of the kernel width
+	for (size_t i = 0; i < count; i++) {
+		vdouble px = VSet(x[i]);
+		vdouble py = VSet(y[i]);
+		vdouble pz = VSet(z[i]);
+		vdouble eps = VSet(softening2);
+		vdouble fx = VSet(0.0);
+		vdouble fy = VSet(0.0);
+		vdouble fz = VSet(0.0);
+		for (size_t j = 0; j < sources; j += VWIDTH) {
+			vdouble dx = VSub(VLoad(sx + j), px);
+			vdouble dy = VSub(VLoad(sy + j), py);
+			vdouble dz = VSub(VLoad(sz + j), pz);
+			if (Periodic) {
+				dx = image.Wrap(dx, 0);
+				dy = image.Wrap(dy, 1);
+				dz = image.Wrap(dz, 2);
+			}
+			vdouble inv = VRsqrt(VFma(dx, dx, VFma(dy, dy, VFma(dz, dz, eps))));
+			vdouble w = VMul(VLoad(sm + j), VMul(inv, VMul(inv, inv)));
+			fx = VFma(w, dx, fx);
+			fy = VFma(w, dy, fy);
+			fz = VFma(w, dz, fz);
+		}
+		ax[i] += GRAVITY * VSum(fx);
+		ay[i] += GRAVITY * VSum(fy);
+		az[i] += GRAVITY * VSum(fz);
+	}
+}
+
+template<bool Periodic>
+static void AccumulateMixedKernel(const double* sx, const double* sy, const double* sz, const float* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* box) {
+	NearestImage<Periodic> image(box);
+	// the inverse cube in float on narrowed separations, each contribution is widened before it is summed and the
+	// gain turns the sum back into an acceleration, sources must be a multiple of twice the kernel width
+	for (size_t i = 0; i < count; i++) {
+		vdouble px = VSet(x[i]);
+		vdouble py = VSet(y[i]);
+		vdouble pz = VSet(z[i]);
+		vfloat eps = VFSet(softening2);
+		vdouble fx[2] = { VSet(0.0), VSet(0.0) };
+		vdouble fy[2] = { VSet(0.0), VSet(0.0) };
+		vdouble fz[2] = { VSet(0.0), VSet(0.0) };
+		for (size_t j = 0; j < sources; j += VFWIDTH) {
+			vfloat dx = Separation(sx + j, px, image, 0);
+			vfloat dy = Separation(sy + j, py, image, 1);
+			vfloat dz = Separation(sz + j, pz, image, 2);
+			vfloat inv = VFRsqrt(VFFma(dx, dx, VFFma(dy, dy, VFFma(dz, dz, eps))));
+			// mass first, so the product climbs towards the inverse cube instead of overshooting it
+			vfloat w = VFMul(VFMul(VFMul(VFLoad(sm + j), inv), inv), inv);
+			vdouble lo, hi;
+			VWiden(VFMul(w, dx), &lo, &hi);
+			fx[0] = VAdd(fx[0], lo);
+			fx[1] = VAdd(fx[1], hi);
+			VWiden(VFMul(w, dy), &lo, &hi);
+			fy[0] = VAdd(fy[0], lo);
+			fy[1] = VAdd(fy[1], hi);
+			VWiden(VFMul(w, dz), &lo, &hi);
+			fz[0] = VAdd(fz[0], lo);
+			fz[1] = VAdd(fz[1], hi);
+		}
+		ax[i] += gain * VSum(VAdd(fx[0], fx[1]));
+		ay[i] += gain * VSum(VAdd(fy[0], fy[1]));
+		az[i] += gain * VSum(VAdd(fz[0], fz[1]));
+	}
+}
+
+template<bool Periodic>
+static void AccumulatePairsKernel(const double* sx, const double* sy, const double* sz, const double* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const double* m, double* ax, double* ay, double* az, size_t count, double softening2, const double* box) {
+	NearestImage<Periodic> image(box);
+	// every target against every source once, with the reaction written back to the sources
+	for (size_t i = 0; i < count; i++) {
+		vdouble px = VSet(x[i]);
+		vdouble py = VSet(y[i]);
+		vdouble pz = VSet(z[i]);
+		vdouble gm = VSet(GRAVITY * m[i]);
+		vdouble eps = VSet(softening2);
+		vdouble fx = VSet(0.0);
+		vdouble fy = VSet(0.0);
+		vdouble fz = VSet(0.0);
+		for (size_t j = 0; j < sources; j += VWIDTH) {
+			vdouble dx = VSub(VLoad(sx + j), px);
+			vdouble dy = VSub(VLoad(sy + j), py);
+			vdouble dz = VSub(VLoad(sz + j), pz);
+			if (Periodic) {
+				dx = image.Wrap(dx, 0);
+				dy = image.Wrap(dy, 1);
+				dz = image.Wrap(dz, 2);
+			}
+			vdouble inv = VRsqrt(VFma(dx, dx, VFma(dy, dy, VFma(dz, dz, eps))));
+			vdouble inv3 = VMul(inv, VMul(inv, inv));
+			vdouble w = VMul(VLoad(sm + j), inv3);
+			fx = VFma(w, dx, fx);
+			fy = VFma(w, dy, fy);
+			fz = VFma(w, dz, fz);
+			vdouble r = VMul(gm, inv3);
+			VStore(sax + j, VSub(VLoad(sax + j), VMul(r, dx)));
+			VStore(say + j, VSub(VLoad(say + j), VMul(r, dy)));
+			VStore(saz + j, VSub(VLoad(saz + j), VMul(r, dz)));
+		}
+		ax[i] += GRAVITY * VSum(fx);
+		ay[i] += GRAVITY * VSum(fy);
+		az[i] += GRAVITY * VSum(fz);
+	}
+}
+
+template<bool Periodic>
+static void AccumulatePairsMixedKernel(const double* sx, const double* sy, const double* sz, const float* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const float* m, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* box) {
+	NearestImage<Periodic> image(box);
+	vdouble g = VSet(gain);
+	for (size_t i = 0; i < count; i++) {
+		vdouble px = VSet(x[i]);
+		vdouble py = VSet(y[i]);
+		vdouble pz = VSet(z[i]);
+		vfloat mi = VFSet(m[i]);
+		vfloat eps = VFSet(softening2);
+		vdouble fx[2] = { VSet(0.0), VSet(0.0) };
+		vdouble fy[2] = { VSet(0.0), VSet(0.0) };
+		vdouble fz[2] = { VSet(0.0), VSet(0.0) };
+		for (size_t j = 0; j < sources; j += VFWIDTH) {
+			vfloat dx = Separation(sx + j, px, image, 0);
+			vfloat dy = Separation(sy + j, py, image, 1);
+			vfloat dz = Separation(sz + j, pz, image, 2);
+			vfloat inv = VFRsqrt(VFFma(dx, dx, VFFma(dy, dy, VFFma(dz, dz, eps))));
+			vfloat w = VFMul(VFMul(VFMul(VFLoad(sm + j), inv), inv), inv);
+			vfloat r = VFMul(VFMul(VFMul(mi, inv), inv), inv);
+			vdouble lo, hi;
+			VWiden(VFMul(w, dx), &lo, &hi);
+			fx[0] = VAdd(fx[0], lo);
+			fx[1] = VAdd(fx[1], hi);
+			VWiden(VFMul(r, dx), &lo, &hi);
+			VStore(sax + j, VSub(VLoad(sax + j), VMul(g, lo)));
+			if (VFWIDTH > 1) VStore(sax + j + VWIDTH, VSub(VLoad(sax + j + VWIDTH), VMul(g, hi)));
+			VWiden(VFMul(w, dy), &lo, &hi);
+			fy[0] = VAdd(fy[0], lo);
+			fy[1] = VAdd(fy[1], hi);
+			VWiden(VFMul(r, dy), &lo, &hi);
+			VStore(say + j, VSub(VLoad(say + j), VMul(g, lo)));
+			if (VFWIDTH > 1) VStore(say + j + VWIDTH, VSub(VLoad(say + j + VWIDTH), VMul(g, hi)));
+			VWiden(VFMul(w, dz), &lo, &hi);
+			fz[0] = VAdd(fz[0], lo);
+			fz[1] = VAdd(fz[1], hi);
+			VWiden(VFMul(r, dz), &lo, &hi);
+			VStore(saz + j, VSub(VLoad(saz + j), VMul(g, lo)));
+			if (VFWIDTH > 1) VStore(saz + j + VWIDTH, VSub(VLoad(saz + j + VWIDTH), VMul(g, hi)));
+		}
+		ax[i] += gain * VSum(VAdd(fx[0], fx[1]));
+		ay[i] += gain * VSum(VAdd(fy[0], fy[1]));
+		az[i] += gain * VSum(VAdd(fz[0], fz[1]));
+	}
+}
+
+static void Accumulate(const double* sx, const double* sy, const double* sz, const double* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2, const double* period) {
+	if (period) AccumulateKernel<true>(sx, sy, sz, sm, sources, x, y, z, ax, ay, az, count, softening2, period);
+	else AccumulateKernel<false>(sx, sy, sz, sm, sources, x, y, z, ax, ay, az, count, softening2, nullptr);
+}
+
+static void AccumulateMixed(const double* sx, const double* sy, const double* sz, const float* sm, size_t sources, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* period) {
+	if (period) AccumulateMixedKernel<true>(sx, sy, sz, sm, sources, x, y, z, ax, ay, az, count, softening2, gain, period);
+	else AccumulateMixedKernel<false>(sx, sy, sz, sm, sources, x, y, z, ax, ay, az, count, softening2, gain, nullptr);
+}
+
+static void AccumulatePairs(const double* sx, const double* sy, const double* sz, const double* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const double* m, double* ax, double* ay, double* az, size_t count, double softening2, const double* period) {
+	if (period) AccumulatePairsKernel<true>(sx, sy, sz, sm, sax, say, saz, sources, x, y, z, m, ax, ay, az, count, softening2, period);
+	else AccumulatePairsKernel<false>(sx, sy, sz, sm, sax, say, saz, sources, x, y, z, m, ax, ay, az, count, softening2, nullptr);
+}
+
+static void AccumulatePairsMixed(const double* sx, const double* sy, const double* sz, const float* sm, double* sax, double* say, double* saz, size_t sources, const double* x, const double* y, const double* z, const float* m, double* ax, double* ay, double* az, size_t count, float softening2, double gain, const double* period) {
+	if (period) AccumulatePairsMixedKernel<true>(sx, sy, sz, sm, sax, say, saz, sources, x, y, z, m, ax, ay, az, count, softening2, gain, period);
+	else AccumulatePairsMixedKernel<false>(sx, sy, sz, sm, sax, say, saz, sources, x, y, z, m, ax, ay, az, count, softening2, gain, nullptr);
+}
+
+static void EvaluateQuadrupole(InteractionList& list, const double* x, const double* y, const double* z, double* ax, double* ay, double* az, size_t count, double softening2) {
+	// a = G * ((m / r^3 + 5/2 (d.Q.d) / r^7) d - (Q.d) / r^5) for the traceless quadrupole Q
+	for (size_t i = 0; i < count; i++) {
+		vdouble px = VSet(x[i]);
+		vdouble py = VSet(y[i]);
+		vdouble pz = VSet(z[i]);
+		vdouble eps = VSet(softening2);
+		vdouble sx = VSet(0.0);
+		vdouble sy = VSet(0.0);
+		vdouble sz = VSet(0.0);
+		for (size_t j = 0; j < list.size; j += VWIDTH) {
+			vdouble dx = VSub(VLoad(&list.x[j]), px);
+			vdouble dy = VSub(VLoad(&list.y[j]), py);
+			vdouble dz = VSub(VLoad(&list.z[j]), pz);
+			vdouble inv = VRsqrt(VFma(dx, dx, VFma(dy, dy, VFma(dz, dz, eps))));
+			vdouble inv2 = VMul(inv, inv);
+			vdouble inv3 = VMul(inv, inv2);
+			vdouble inv5 = VMul(inv3, inv2);
+			vdouble inv7 = VMul(inv5, inv2);
+			vdouble qxx = VLoad(&list.q[0][j]);
+			vdouble qxy = VLoad(&list.q[1][j]);
+			vdouble qxz = VLoad(&list.q[2][j]);
+			vdouble qyy = VLoad(&list.q[3][j]);
+			vdouble qyz = VLoad(&list.q[4][j]);
+			vdouble qzz = VLoad(&list.q[5][j]);
+			vdouble qdx = VFma(qxx, dx, VFma(qxy, dy, VMul(qxz, dz)));
+			vdouble qdy = VFma(qxy, dx, VFma(qyy, dy, VMul(qyz, dz)));
+			vdouble qdz = VFma(qxz, dx, VFma(qyz, dy, VMul(qzz, dz)));
+			vdouble dqd = VFma(dx, qdx, VFma(dy, qdy, VMul(dz, qdz)));
+			vdouble w = VFma(VLoad(&list.m[j]), inv3, VMul(VSet(2.5), VMul(dqd, inv7)));
+			sx = VSub(VFma(w, dx, sx), VMul(inv5, qdx));
+			sy = VSub(VFma(w, dy, sy), VMul(inv5, qdy));
+			sz = VSub(VFma(w, dz, sz), VMul(inv5, qdz));
+		}
+		ax[i] += GRAVITY * VSum(sx);
+		ay[i] += GRAVITY * VSum(sy);
+		az[i] += GRAVITY * VSum(sz);
+	}
+}
+
+#ifdef KERNEL_TARGET
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
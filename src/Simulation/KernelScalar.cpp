@@ -0,0 +1,5 @@
+#include "Simulation/Kernel.h"
+#define KERNEL_ISA KERNEL_ISA_SCALAR
+#include "Simulation/KernelBody.h"
+
+const KernelSet ScalarKernels = { "scalar", Accumulate, AccumulateMixed, AccumulatePairs, AccumulatePairsMixed, EvaluateQuadrupole };
@@ -0,0 +1,274 @@
+#include "Multipole.h"
+#include <algorithm>
+#include <cmath>
+
+// expansions are cartesian taylor series of the softened kernel 1/sqrt(r^2 + e^2), stored as one
+// coefficient per multi-index n = (x, y, z) with |n| <= order, ordered by total degree
+//     multipole  M_n = sum m (y - c)^n / n!
+//     local      L_k = sum_n (-1)^|n| M_n D^(n+k)(c_target - c_source)
+
+void FastMultipole::SetOrder(uint32_t order) {
+    order = std::max(1u, std::min(order, (uint32_t)FMM_MAX_ORDER));
+    if (order == m_Order) return;
+    m_Order = order;
+    m_Exponents.clear();
+    m_Index.assign((order + 1) * (order + 1) * (order + 1), -1);
+    for (int32_t total = 0; total <= (int32_t)order; total++) {
+        for (int32_t x = total; x >= 0; x--) {
+            for (int32_t y = total - x; y >= 0; y--) {
+                m_Index[Term(x, y, total - x - y)] = (int32_t)m_Exponents.size();
+                m_Exponents.push_back({ x, y, total - x - y });
+            }
+        }
+    }
+    m_Terms = m_Exponents.size();
+
+    // every pair of multi-indices whose sum is still within the order, shared by all three translations
+    m_Pairs.clear();
+    for (size_t a = 0; a < m_Terms; a++) {
+        glm::ivec3 ea = m_Exponents[a];
+        size_t limit = TermsUpTo(order - (ea.x + ea.y + ea.z));
+        for (size_t b = 0; b < limit; b++) {
+            glm::ivec3 eb = m_Exponents[b];
+            m_Pairs.push_back({ (int32_t)a, (int32_t)b, m_Index[Term(ea.x + eb.x, ea.y + eb.y, ea.z + eb.z)] });
+        }
+    }
+}
+
+void FastMultipole::Prepare(FlatOcttree* tree, size_t target, double unitsize, const ForceParameters &parameters) {
+    m_Tree = tree;
+    m_UnitSize = unitsize;
+    m_Parameters = parameters;
+    if (m_Order == 0) SetOrder(1);
+    size_t size = tree->Size();
+    if (m_Multipoles.size() < size * m_Terms) m_Multipoles.resize(size * m_Terms);
+    if (m_Locals.size() < size * m_Terms) m_Locals.resize(size * m_Terms);
+    if (m_Radius.size() < size) m_Radius.resize(size);
+    if (m_Near.size() < size) m_Near.resize(size);
+
+    // split the largest subtrees until there are enough independent ones to hand out
+    m_Tasks.clear();
+    m_Top.clear();
+    m_Tasks.push_back(0);
+    while (m_Tasks.size() < target) {
+        auto largest = std::max_element(m_Tasks.begin(), m_Tasks.end(), [this](int32_t a, int32_t b) {
+            return (IsLeaf(a) ? 0 : m_Tree->Node(a).count) < (IsLeaf(b) ? 0 : m_Tree->Node(b).count);
+        });
+        int32_t node = *largest;
+        if (IsLeaf(node)) break;
+        m_Tasks.erase(largest);
+        m_Top.push_back(node);
+        for (int32_t i = 0; i < 8; i++) {
+            if (m_Tree->Node(m_Tree->Node(node).child + i).count > 0)
+                m_Tasks.push_back(m_Tree->Node(node).child + i);
+        }
+    }
+}
+
+void FastMultipole::Upward(int32_t node, MultipoleScratch &scratch) {
+    FlatOctNode& current = m_Tree->Node(node);
+    double* multipole = &m_Multipoles[node * m_Terms];
+    std::fill(multipole, multipole + m_Terms, 0.0);
+    std::fill(&m_Locals[node * m_Terms], &m_Locals[node * m_Terms] + m_Terms, 0.0);
+    m_Near[node].clear();
+    m_Radius[node] = 0.0;
+    if (current.count == 0) return;
+    glm::dvec3 center = Center(node);
+    if (IsLeaf(node)) {
+        // particle to multipole
+        scratch.monomials.resize(m_Terms);
+        scratch.targets.clear();
+        m_Tree->GatherParticles(node, &scratch.targets);
+        for (uint32_t index : scratch.targets) {
+            glm::dvec3 s = m_UnitSize * m_Tree->Particles()->Position(index) - center;
+            m_Radius[node] = std::max(m_Radius[node], glm::length(s));
+            Monomials(s, scratch.monomials.data());
+            for (size_t t = 0; t < m_Terms; t++)
+                multipole[t] += m_Tree->Particles()->Mass(index) * scratch.monomials[t];
+        }
+        return;
+    }
+    for (int32_t i = 0; i < 8; i++) {
+        int32_t child = current.child + i;
+        Upward(child, scratch);
+        if (m_Tree->Node(child).count > 0) TranslateMultipole(child, node, scratch);
+    }
+}
+
+void FastMultipole::UpwardTop() {
+    // the split nodes were recorded parents first, so walk them backwards
+    for (auto it = m_Top.rbegin(); it != m_Top.rend(); it++) {
+        int32_t node = *it;
+        std::fill(&m_Multipoles[node * m_Terms], &m_Multipoles[node * m_Terms] + m_Terms, 0.0);
+        m_Radius[node] = 0.0;
+        for (int32_t i = 0; i < 8; i++) {
+            int32_t child = m_Tree->Node(node).child + i;
+            if (m_Tree->Node(child).count > 0) TranslateMultipole(child, node, m_Scratch);
+        }
+    }
+}
+
+void FastMultipole::Interact(int32_t target, int32_t source, MultipoleScratch &scratch) {
+    // dual tree walk, only nodes below target are written so disjoint targets can run in parallel
+    FlatOctNode& t = m_Tree->Node(target);
+    FlatOctNode& s = m_Tree->Node(source);
+    if (t.count == 0 || s.count == 0) return;
+    glm::dvec3 r = Center(target) - Center(source);
+    double distance = glm::length(r);
+    if (m_Radius[target] + m_Radius[source] < m_Parameters.theta * distance) {
+        // multipole to local
+        Derivatives(r, scratch);
+        double* local = &m_Locals[target * m_Terms];
+        const double* multipole = &m_Multipoles[source * m_Terms];
+        scratch.monomials.resize(m_Terms);
+        for (size_t n = 0; n < m_Terms; n++)
+            scratch.monomials[n] = (m_Exponents[n].x + m_Exponents[n].y + m_Exponents[n].z) % 2 == 0 ? multipole[n] : -multipole[n];
+        for (const glm::ivec3& pair : m_Pairs)
+            local[pair.x] += scratch.monomials[pair.y] * scratch.derivatives[pair.z];
+        return;
+    }
+    bool tleaf = IsLeaf(target);
+    bool sleaf = IsLeaf(source);
+    if (tleaf && sleaf) {
+        m_Near[target].push_back(source);
+    } else if (sleaf || (!tleaf && m_Radius[target] >= m_Radius[source])) {
+        for (int32_t i = 0; i < 8; i++)
+            Interact(t.child + i, source, scratch);
+    } else {
+        for (int32_t i = 0; i < 8; i++)
+            Interact(target, s.child + i, scratch);
+    }
+}
+
+void FastMultipole::Downward(int32_t node, MultipoleScratch &expansion, GroupScratch &scratch) {
+    FlatOctNode& current = m_Tree->Node(node);
+    if (current.count == 0) return;
+    const double* local = &m_Locals[node * m_Terms];
+    glm::dvec3 center = Center(node);
+    expansion.monomials.resize(m_Terms);
+    if (!IsLeaf(node)) {
+        // local to local
+        for (int32_t i = 0; i < 8; i++) {
+            int32_t child = current.child + i;
+            if (m_Tree->Node(child).count == 0) continue;
+            Monomials(Center(child) - center, expansion.monomials.data());
+            double* target = &m_Locals[child * m_Terms];
+            for (const glm::ivec3& pair : m_Pairs)
+                target[pair.x] += local[pair.z] * expansion.monomials[pair.y];
+            Downward(child, expansion, scratch);
+        }
+        return;
+    }
+
+    // local to particle, the gradient of the expansion drops one degree
+    expansion.targets.clear();
+    m_Tree->GatherParticles(node, &expansion.targets);
+    size_t count = expansion.targets.size();
+    scratch.x.resize(count);
+    scratch.y.resize(count);
+    scratch.z.resize(count);
+    scratch.ax.resize(count);
+    scratch.ay.resize(count);
+    scratch.az.resize(count);
+    size_t limit = TermsUpTo(m_Order - 1);
+    for (size_t i = 0; i < count; i++) {
+        glm::dvec3 pos = m_UnitSize * m_Tree->Particles()->Position(expansion.targets[i]);
+        scratch.x[i] = pos.x;
+        scratch.y[i] = pos.y;
+        scratch.z[i] = pos.z;
+        Monomials(pos - center, expansion.monomials.data());
+        glm::dvec3 gradient = { 0, 0, 0 };
+        for (size_t n = 0; n < limit; n++) {
+            glm::ivec3 en = m_Exponents[n];
+            gradient.x += local[m_Index[Term(en.x + 1, en.y, en.z)]] * expansion.monomials[n];
+            gradient.y += local[m_Index[Term(en.x, en.y + 1, en.z)]] * expansion.monomials[n];
+            gradient.z += local[m_Index[Term(en.x, en.y, en.z + 1)]] * expansion.monomials[n];
+        }
+        scratch.ax[i] = GRAVITY * gradient.x;
+        scratch.ay[i] = GRAVITY * gradient.y;
+        scratch.az[i] = GRAVITY * gradient.z;
+    }
+
+    // particle to particle against every leaf that was too close to expand
+    scratch.list.Clear();
+    for (int32_t source : m_Near[node]) {
+        expansion.sources.clear();
+        m_Tree->GatherParticles(source, &expansion.sources);
+        for (uint32_t index : expansion.sources) {
+            glm::dvec3 pos = m_Tree->Particles()->Position(index);
+            scratch.list.Push(m_UnitSize * pos.x, m_UnitSize * pos.y, m_UnitSize * pos.z, m_Tree->Particles()->Mass(index));
+        }
+    }
+    ForceKernel::Evaluate(scratch.list, scratch.x.data(), scratch.y.data(), scratch.z.data(), scratch.ax.data(), scratch.ay.data(), scratch.az.data(), count, m_Parameters.softening * m_Parameters.softening);
+    for (size_t i = 0; i < count; i++)
+        m_Tree->Particles()->SetAcceleration(expansion.targets[i], { scratch.ax[i], scratch.ay[i], scratch.az[i] });
+}
+
+bool FastMultipole::IsLeaf(int32_t node) {
+    return m_Tree->Node(node).child < 0 || m_Tree->Node(node).count <= FMM_LEAF_SIZE;
+}
+
+glm::dvec3 FastMultipole::Center(int32_t node) {
+    return m_UnitSize * m_Tree->Node(node).center;
+}
+
+void FastMultipole::Monomials(const glm::dvec3 &h, double* out) {
+    // h^n / n! for every multi-index
+    double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1], pz[FMM_MAX_ORDER + 1];
+    px[0] = py[0] = pz[0] = 1.0;
+    for (uint32_t i = 1; i <= m_Order; i++) {
+        px[i] = px[i - 1] * h.x / i;
+        py[i] = py[i - 1] * h.y / i;
+        pz[i] = pz[i - 1] * h.z / i;
+    }
+    for (size_t t = 0; t < m_Terms; t++)
+        out[t] = px[m_Exponents[t].x] * py[m_Exponents[t].y] * pz[m_Exponents[t].z];
+}
+
+void FastMultipole::Derivatives(const glm::dvec3 &r, MultipoleScratch &scratch) {
+    // hermite style recurrence over auxiliary orders m,
+    //     R(m)_000   = (-1)^m (2m - 1)!! / s^(m + 1/2)
+    //     R(m)_n+e_x = x R(m+1)_n + n_x R(m+1)_n-e_x
+    // and D^n = R(0)_n
+    scratch.recurrence.resize((m_Order + 1) * m_Terms);
+    scratch.derivatives.resize(m_Terms);
+    double inv2 = 1.0 / (r.x*r.x + r.y*r.y + r.z*r.z + m_Parameters.softening * m_Parameters.softening);
+    double f = std::sqrt(inv2);
+    double base[FMM_MAX_ORDER + 1];
+    for (uint32_t m = 0; m <= m_Order; m++) {
+        base[m] = f;
+        f *= -(2.0 * m + 1.0) * inv2;
+    }
+    for (int32_t m = m_Order; m >= 0; m--) {
+        double* current = scratch.recurrence.data() + m * m_Terms;
+        const double* next = scratch.recurrence.data() + (m + 1) * m_Terms;
+        size_t limit = TermsUpTo(m_Order - m);
+        current[0] = base[m];
+        for (size_t t = 1; t < limit; t++) {
+            glm::ivec3 e = m_Exponents[t];
+            if (e.x > 0) {
+                current[t] = r.x * next[m_Index[Term(e.x - 1, e.y, e.z)]];
+                if (e.x > 1) current[t] += (e.x - 1) * next[m_Index[Term(e.x - 2, e.y, e.z)]];
+            } else if (e.y > 0) {
+                current[t] = r.y * next[m_Index[Term(e.x, e.y - 1, e.z)]];
+                if (e.y > 1) current[t] += (e.y - 1) * next[m_Index[Term(e.x, e.y - 2, e.z)]];
+            } else {
+                current[t] = r.z * next[m_Index[Term(e.x, e.y, e.z - 1)]];
+                if (e.z > 1) current[t] += (e.z - 1) * next[m_Index[Term(e.x, e.y, e.z - 2)]];
+            }
+        }
+    }
+    std::copy(scratch.recurrence.begin(), scratch.recurrence.begin() + m_Terms, scratch.derivatives.begin());
+}
+
+void FastMultipole::TranslateMultipole(int32_t child, int32_t parent, MultipoleScratch &scratch) {
+    // multipole to multipole, M_(a + b) += M_a d^b / b!
+    glm::dvec3 d = Center(child) - Center(parent);
+    scratch.monomials.resize(m_Terms);
+    Monomials(d, scratch.monomials.data());
+    const double* source = &m_Multipoles[child * m_Terms];
+    double* target = &m_Multipoles[parent * m_Terms];
+    for (const glm::ivec3& pair : m_Pairs)
+        target[pair.z] += source[pair.x] * scratch.monomials[pair.y];
+    m_Radius[parent] = std::max(m_Radius[parent], glm::length(d) + m_Radius[child]);
+}
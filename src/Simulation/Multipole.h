@@ -0,0 +1,51 @@
+#pragma once
+#include "Simulation/FlatOcttree.h"
+#include <vector>
+
+#define FMM_MAX_ORDER 8
+#define FMM_LEAF_SIZE 16
+
+struct MultipoleScratch {
+    std::vector<double> recurrence;
+    std::vector<double> derivatives;
+    std::vector<double> monomials;
+    std::vector<uint32_t> targets;
+    std::vector<uint32_t> sources;
+};
+
+class FastMultipole {
+public:
+    uint32_t Order() { return m_Order; }
+    void SetOrder(uint32_t order);
+    std::vector<int32_t>& Tasks() { return m_Tasks; }
+public:
+    void Prepare(FlatOcttree* tree, size_t target, double unitsize, const ForceParameters &parameters);
+    void Upward(int32_t node, MultipoleScratch &scratch);
+    void UpwardTop();
+    void Interact(int32_t target, int32_t source, MultipoleScratch &scratch);
+    void Downward(int32_t node, MultipoleScratch &expansion, GroupScratch &scratch);
+private:
+    int32_t Term(int32_t x, int32_t y, int32_t z) { return (x * (m_Order + 1) + y) * (m_Order + 1) + z; }
+    size_t TermsUpTo(int32_t order) { return (size_t)((order + 1) * (order + 2) * (order + 3) / 6); }
+    bool IsLeaf(int32_t node);
+    glm::dvec3 Center(int32_t node);
+    void Monomials(const glm::dvec3 &h, double* out);
+    void Derivatives(const glm::dvec3 &r, MultipoleScratch &scratch);
+    void TranslateMultipole(int32_t child, int32_t parent, MultipoleScratch &scratch);
+private:
+    FlatOcttree* m_Tree = nullptr;
+    double m_UnitSize = 1.0;
+    ForceParameters m_Parameters;
+    uint32_t m_Order = 0;
+    size_t m_Terms = 0;
+    std::vector<glm::ivec3> m_Exponents;
+    std::vector<int32_t> m_Index;
+    std::vector<glm::ivec3> m_Pairs;
+    std::vector<double> m_Multipoles;
+    std::vector<double> m_Locals;
+    std::vector<double> m_Radius;
+    std::vector<std::vector<int32_t>> m_Near;
+    std::vector<int32_t> m_Tasks;
+    std::vector<int32_t> m_Top;
+    MultipoleScratch m_Scratch;
+};
@@ -394,7 +394,7 @@ void Network::HostProcess() {
 					p.SetVelocity(p.Velocity() + (0.5 * m_SimulationRef->Timestep() * p.Acceleration())/m_SimulationRef->UnitSize());
                     p.SetAcceleration({ 0.0, 0.0, 0.0 });
                     for (size_t j = 0; j < m_Trees.size; j++) {
-                        m_Trees.trees[j].SerialCalculateForce(p, m_SimulationRef->UnitSize());
+                        m_Trees.trees[j].SerialCalculateForce(p, m_SimulationRef->UnitSize(), m_SimulationRef->Forces());
                     }
                     EvaluateStage es;
                     es.set_origin_id(((uint64_t)-1));
@@ -452,7 +452,7 @@ void Network::HostProcess() {
                         m_SimulationRef->SimulationRecord()[m_SimulationRef->SimulationRecord().size() - 1].push_back(p);
                     } else {
                         for (size_t j = 0; j < m_Trees.size; j++) {
-                            m_Trees.trees[j].SerialCalculateForce(p, m_SimulationRef->UnitSize());
+                            m_Trees.trees[j].SerialCalculateForce(p, m_SimulationRef->UnitSize(), m_SimulationRef->Forces());
                         }
                         es.set_px(p.Position().x);
                         es.set_py(p.Position().y);
@@ -722,7 +722,7 @@ void Network::ClientProcess() {
 					    p.SetVelocity(p.Velocity() + (0.5 * m_SimulationRef->Timestep() * p.Acceleration())/m_SimulationRef->UnitSize());
                         p.SetAcceleration({ 0.0, 0.0, 0.0 });
                         for (size_t j = 0; j < m_Trees.size; j++) {
-                            m_Trees.trees[j].SerialCalculateForce(p, m_SimulationRef->UnitSize());
+                            m_Trees.trees[j].SerialCalculateForce(p, m_SimulationRef->UnitSize(), m_SimulationRef->Forces());
                         }
                         EvaluateStage es_out;
                         es_out.set_origin_id(m_ClientID);
@@ -783,7 +783,7 @@ void Network::ClientProcess() {
                             }
                         } else {
                             for (size_t j = 0; j < m_Trees.size; j++) {
-                                m_Trees.trees[j].SerialCalculateForce(p, m_SimulationRef->UnitSize());
+                                m_Trees.trees[j].SerialCalculateForce(p, m_SimulationRef->UnitSize(), m_SimulationRef->Forces());
                             }
                             es.set_px(p.Position().x);
                             es.set_py(p.Position().y);
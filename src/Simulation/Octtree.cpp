@@ -20,24 +20,33 @@ void Octtree::GetLeaves(std::vector<Octtree*>* leaves) {
 void Octtree::Insert(Particle* particle) {
     if (!m_Boundary.Contains(particle)) return;
     if (m_Leaf) {
-        if (!m_Particle) {
-            m_Particle = particle;
-            m_CenterOfMass = *particle;
-            return;
-        } else {
-            Subdivide();
-            InsertIntoChildren(particle);
-            m_Particle = nullptr;
-            m_Leaf = false;
+        // leaves hold a small bucket, and once boxes stop shrinking they keep every duplicate instead of splitting forever
+        if (m_Bucket.size() < m_Capacity || m_Depth >= MAX_DEPTH) {
+            m_Bucket.push_back(particle);
+            if (m_Bucket.size() == 1) m_CenterOfMass = *particle;
             return;
         }
+        Subdivide();
+        m_Leaf = false;
+        for (Particle* moved : m_Bucket) InsertIntoChildren(moved);
+        m_Bucket.clear();
     }
     InsertIntoChildren(particle);
 }
 
 void Octtree::CalculateCenterOfMass() {
-    if (m_Leaf && m_Particle) {
-        //m_CenterOfMass = *m_Particle;
+    if (m_Leaf) {
+        if (m_Bucket.size() <= 1) return;
+        double totalMass = 0;
+        glm::dvec3 cm = { 0, 0, 0 };
+        for (Particle* particle : m_Bucket) {
+            totalMass += particle->Mass();
+            cm += particle->Mass() * particle->Position();
+        }
+        if (totalMass > 0) {
+            m_CenterOfMass.SetMass(totalMass);
+            m_CenterOfMass.SetPosition(cm / totalMass);
+        }
         return;
     }
 
@@ -49,7 +58,18 @@ void Octtree::CalculateCenterOfMass() {
     if (m_BNE) m_BNE->CalculateCenterOfMass();
     if (m_BSW) m_BSW->CalculateCenterOfMass();
     if (m_BSE) m_BSE->CalculateCenterOfMass();
+    CombineChildren();
+}
+
+void Octtree::CalculateTopCenterOfMass() {
+    // subtrees handed out to the workers stop counting towards the shared size and already have their moments
+    if (m_SizeRef == nullptr || m_Leaf) return;
+    for (auto& child : { m_BNW.get(), m_BNE.get(), m_BSW.get(), m_BSE.get(), m_TNW.get(), m_TNE.get(), m_TSW.get(), m_TSE.get() })
+        child->CalculateTopCenterOfMass();
+    CombineChildren();
+}
 
+void Octtree::CombineChildren() {
     double totalMass = 0;
     double cmX = 0;
     double cmY = 0;
@@ -68,39 +88,56 @@ void Octtree::CalculateCenterOfMass() {
     }
 }
 
-void Octtree::SerialCalculateForce(Particle &p, double unitsize) {
-    if (m_Leaf) {
-        if (m_Particle && 
-            (m_Particle->Position().x != p.Position().x ||
-            m_Particle->Position().y != p.Position().y ||
-            m_Particle->Position().z != p.Position().z))
-            SerialApplyForce(p, *m_Particle, unitsize);
-        return;
+size_t Octtree::SerialCalculateForce(Particle &p, double unitsize, const ForceParameters &parameters, double reference) {
+    if (m_Leaf && m_Bucket.size() <= 1) {
+        if (!m_Bucket.empty() &&
+            (m_Bucket[0]->Position().x != p.Position().x ||
+            m_Bucket[0]->Position().y != p.Position().y ||
+            m_Bucket[0]->Position().z != p.Position().z)) {
+            SerialApplyForce(p, *m_Bucket[0], unitsize, parameters.softening);
+            return 1;
+        }
+        return 0;
     }
     double dx = unitsize * (m_CenterOfMass.Position().x - p.Position().x);
     double dy = unitsize * (m_CenterOfMass.Position().y - p.Position().y);
     double dz = unitsize * (m_CenterOfMass.Position().z - p.Position().z);
     double distance = std::sqrt(dx*dx + dy*dy + dz*dz);
-    if (m_Boundary.radius / distance < THETA) {
+    double gx = std::max(std::abs(p.Position().x - m_Boundary.x) - m_Boundary.radius, 0.0);
+    double gy = std::max(std::abs(p.Position().y - m_Boundary.y) - m_Boundary.radius, 0.0);
+    double gz = std::max(std::abs(p.Position().z - m_Boundary.z) - m_Boundary.radius, 0.0);
+    double gap = unitsize * std::sqrt(gx*gx + gy*gy + gz*gz);
+    if (!m_Boundary.Contains(&p) && parameters.Accept(unitsize * m_Boundary.radius, m_CenterOfMass.Mass(), distance, gap, reference)) {
         Particle vm = m_CenterOfMass;
-        SerialApplyForce(p, vm, unitsize);
-    } else {
-        if (m_TNW) m_TNW->SerialCalculateForce(p, unitsize);
-        if (m_TNE) m_TNE->SerialCalculateForce(p, unitsize);
-        if (m_TSW) m_TSW->SerialCalculateForce(p, unitsize);
-        if (m_TSE) m_TSE->SerialCalculateForce(p, unitsize);
-        if (m_BNW) m_BNW->SerialCalculateForce(p, unitsize);
-        if (m_BNE) m_BNE->SerialCalculateForce(p, unitsize);
-        if (m_BSW) m_BSW->SerialCalculateForce(p, unitsize);
-        if (m_BSE) m_BSE->SerialCalculateForce(p, unitsize);
+        SerialApplyForce(p, vm, unitsize, parameters.softening);
+        return 1;
+    }
+    size_t interactions = 0;
+    if (m_Leaf) {
+        // buckets too close to summarize are summed directly, skipping the particle itself
+        for (Particle* other : m_Bucket) {
+            if (other->Position() == p.Position()) continue;
+            SerialApplyForce(p, *other, unitsize, parameters.softening);
+            interactions++;
+        }
+        return interactions;
     }
+    if (m_TNW) interactions += m_TNW->SerialCalculateForce(p, unitsize, parameters, reference);
+    if (m_TNE) interactions += m_TNE->SerialCalculateForce(p, unitsize, parameters, reference);
+    if (m_TSW) interactions += m_TSW->SerialCalculateForce(p, unitsize, parameters, reference);
+    if (m_TSE) interactions += m_TSE->SerialCalculateForce(p, unitsize, parameters, reference);
+    if (m_BNW) interactions += m_BNW->SerialCalculateForce(p, unitsize, parameters, reference);
+    if (m_BNE) interactions += m_BNE->SerialCalculateForce(p, unitsize, parameters, reference);
+    if (m_BSW) interactions += m_BSW->SerialCalculateForce(p, unitsize, parameters, reference);
+    if (m_BSE) interactions += m_BSE->SerialCalculateForce(p, unitsize, parameters, reference);
+    return interactions;
 }
 
-void Octtree::SerialApplyForce(Particle &p, Particle &other, double unitsize) {
+void Octtree::SerialApplyForce(Particle &p, Particle &other, double unitsize, double softening) {
     double dx = unitsize * (other.Position().x - p.Position().x);
     double dy = unitsize * (other.Position().y - p.Position().y);
     double dz = unitsize * (other.Position().z - p.Position().z);
-	double inv_r3 = std::pow((dx*dx) + (dy*dy) + (dz*dz) + (3*3), -1.5);
+	double inv_r3 = std::pow((dx*dx) + (dy*dy) + (dz*dz) + (softening*softening), -1.5);
 	glm::dvec3 pa = { 0, 0, 0 };
     glm::dvec3 olda = p.Acceleration();
 	pa.x = olda.x + (GRAVITY * (dx * inv_r3) * other.Mass());
@@ -110,7 +147,7 @@ void Octtree::SerialApplyForce(Particle &p, Particle &other, double unitsize) {
 }
 
 void Octtree::AsList(std::vector<std::pair<Oct, Particle*>>* list) {
-    std::pair<Oct, Particle*> pair(m_Boundary, m_Particle);
+    std::pair<Oct, Particle*> pair(m_Boundary, m_Bucket.empty() ? nullptr : m_Bucket[0]);
     if (m_Leaf) {
         list->push_back(pair);
     }
@@ -133,6 +170,10 @@ void Octtree::Subdivide() {
     m_BNE = CreateScope<Octtree>(m_Boundary.BNE(), m_SizeRef);
     m_BSW = CreateScope<Octtree>(m_Boundary.BSW(), m_SizeRef);
     m_BSE = CreateScope<Octtree>(m_Boundary.BSE(), m_SizeRef);
+    for (auto& child : { m_BNW.get(), m_BNE.get(), m_BSW.get(), m_BSE.get(), m_TNW.get(), m_TNE.get(), m_TSW.get(), m_TSE.get() }) {
+        child->m_Capacity = m_Capacity;
+        child->m_Depth = m_Depth + 1;
+    }
     if (m_SizeRef != nullptr) (*m_SizeRef)--;
 }
 
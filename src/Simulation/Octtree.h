@@ -3,7 +3,13 @@
 #include "Core/Safety.h"
 
 #define GRAVITY 0.0000000000667430
-#define THETA 0.5
+#define MAX_DEPTH 21
+#define MAX_LEAF_SIZE 64
+// the kernels rely on a softened self pair to give zero force, and a vanishing opening angle never stops opening
+#define MIN_SOFTENING 0.001
+#define MIN_THETA 0.01
+
+class EwaldTable;
 
 struct Oct {
     double x;
@@ -18,6 +24,14 @@ struct Oct {
 			particle->Position().z >= z - radius &&
 			particle->Position().z < z + radius;
     }
+    bool Contains(const glm::dvec3 &position) {
+        return position.x >= x - radius &&
+            position.x < x + radius &&
+            position.y >= y - radius &&
+            position.y < y + radius &&
+			position.z >= z - radius &&
+			position.z < z + radius;
+    }
     Oct TNW() const { return {x - radius / 2, y + radius / 2, z + radius / 2, radius / 2}; }
     Oct TNE() const { return {x + radius / 2, y + radius / 2, z + radius / 2, radius / 2}; }
     Oct TSW() const { return {x - radius / 2, y - radius / 2, z + radius / 2, radius / 2}; }
@@ -28,23 +42,54 @@ struct Oct {
     Oct BSE() const { return {x + radius / 2, y - radius / 2, z - radius / 2, radius / 2}; }
 };
 
+enum class OpeningCriterion {
+    GEOMETRIC = 0,
+    MINDISTANCE = 1,
+    RELATIVE = 2,
+};
+
+struct ForceParameters {
+    OpeningCriterion opening = OpeningCriterion::GEOMETRIC;
+    double theta = 0.5;
+    double softening = 3.0;
+    // side lengths of the periodic box in meters, zero for open boundaries, and the correction for the images beyond it
+    glm::dvec3 period = { 0, 0, 0 };
+    const EwaldTable* ewald = nullptr;
+    bool Periodic() const { return period.x > 0.0; }
+    // scale in meters the long range part is split off at for a mesh to carry, zero when the tree carries all of it
+    double split = 0.0;
+    // whether a node of this half width and mass may stand in for its particles, seen from distance to its
+    // center of mass and gap to its box, both in meters, by a target last pulled with the given acceleration
+    bool Accept(double radius, double mass, double distance, double gap, double reference) const {
+        if (opening == OpeningCriterion::MINDISTANCE) return radius < theta * gap;
+        if (opening == OpeningCriterion::RELATIVE && reference > 0.0) {
+            // bound the neglected quadrupole term against the target's own acceleration, theta squared is the tolerance
+            double size = 2.0 * radius;
+            return GRAVITY * mass * size * size <= theta * theta * reference * distance * distance * distance * distance;
+        }
+        return radius < theta * distance;
+    }
+};
+
 class Octtree {
 public:
     Octtree() {};
-    Octtree(const Oct &boundary, size_t* sizeref) { m_Boundary = boundary; m_SizeRef = sizeref; if (m_SizeRef != nullptr) (*m_SizeRef)++; }
+    Octtree(const Oct &boundary, size_t* sizeref, uint32_t capacity = 1) { m_Boundary = boundary; m_SizeRef = sizeref; m_Capacity = capacity; if (m_SizeRef != nullptr) (*m_SizeRef)++; }
     bool Contains(Particle* particle) { return m_Boundary.Contains(particle); }
 public:
     void GetLeaves(std::vector<Octtree*>* leaves);
 public:
     void Insert(Particle* particle);
     void CalculateCenterOfMass();
+    void CalculateTopCenterOfMass();
 public:
-    void SerialCalculateForce(Particle &p, double unitsize);
-    void SerialApplyForce(Particle &p, Particle &other, double unitsize);
+    size_t SerialCalculateForce(Particle &p, double unitsize, const ForceParameters &parameters, double reference = 0.0);
+    void SerialApplyForce(Particle &p, Particle &other, double unitsize, double softening);
 public:
     void AsList(std::vector<std::pair<Oct, Particle*>>* list);
 private:
     void Subdivide();
+    void CombineChildren();
     void InsertIntoChildren(Particle* particle);
 public:
     size_t* m_SizeRef = nullptr;
@@ -59,5 +104,7 @@ public:
     Scope<Octtree> m_BNE = nullptr;
     Scope<Octtree> m_BSW = nullptr;
     Scope<Octtree> m_BSE = nullptr;
-    Particle* m_Particle = nullptr;
+    std::vector<Particle*> m_Bucket;
+    uint32_t m_Capacity = 1;
+    uint32_t m_Depth = 0;
 };
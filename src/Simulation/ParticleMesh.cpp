@@ -0,0 +1,277 @@
+#include "ParticleMesh.h"
+#include "Simulation/Octtree.h"
+#include <algorithm>
+#include <cmath>
+
+static void FFT(std::complex<double>* a, size_t n, const std::vector<std::complex<double>> &twiddles, const std::vector<uint32_t> &reversal, bool inverse) {
+    // iterative radix 2 cooley tukey, the inverse is left unscaled, the butterflies multiply out by hand since
+    // std::complex products go through the nan checking library call
+    for (size_t i = 0; i < n; i++)
+        if (i < reversal[i]) std::swap(a[i], a[reversal[i]]);
+    double sign = inverse ? -1.0 : 1.0;
+    for (size_t length = 2; length <= n; length <<= 1) {
+        size_t step = n / length;
+        size_t half = length / 2;
+        for (size_t k = 0; k < half; k++) {
+            double wr = twiddles[k * step].real();
+            double wi = sign * twiddles[k * step].imag();
+            for (size_t i = 0; i < n; i += length) {
+                double ur = a[i + k].real();
+                double ui = a[i + k].imag();
+                double xr = a[i + k + half].real();
+                double xi = a[i + k + half].imag();
+                double vr = xr * wr - xi * wi;
+                double vi = xr * wi + xi * wr;
+                a[i + k] = { ur + vr, ui + vi };
+                a[i + k + half] = { ur - vr, ui - vi };
+            }
+        }
+    }
+}
+
+bool ParticleMesh::Prepare(ParticleSoA* particles, size_t workers, uint32_t resolution, double split, double unitsize, const glm::dvec3 &lo, const glm::dvec3 &hi, const glm::dvec3 &period) {
+    m_Particles = particles;
+    m_UnitSize = unitsize;
+    bool periodic = period.x > 0.0;
+    bool fresh = periodic != m_Periodic || resolution != m_Resolution || split != m_Cells;
+    m_Periodic = periodic;
+    m_Cells = split;
+    Layout(resolution, workers);
+
+    glm::dvec3 spacing;
+    if (periodic) {
+        spacing = period / (double)resolution;
+        m_Origin = -0.5 * period;
+    } else {
+        // cubic cells over the particles, only respaced when they outgrow the mesh or shrink well inside it
+        // since every new spacing costs a transform of the green's function, the mesh just follows their middle
+        glm::dvec3 span = unitsize * (hi - lo);
+        double widest = std::max(span.x, std::max(span.y, span.z));
+        double room = (double)(resolution - 2 * MESH_MARGIN - 1);
+        double h = m_Spacing.x;
+        if (fresh || widest > room * h || widest < 0.5 * room * h)
+            h = (widest > 0.0 ? widest : 1.0) * (1.0 + MESH_PADDING) / room;
+        spacing = glm::dvec3(h);
+        m_Origin = 0.5 * unitsize * (lo + hi) - 0.5 * (double)resolution * spacing;
+    }
+    fresh = fresh || spacing != m_Spacing;
+    m_Spacing = spacing;
+    m_Split = split * std::min(spacing.x, std::min(spacing.y, spacing.z));
+    if (!fresh) return false;
+
+    const double pi = 3.14159265358979323846;
+    size_t n = m_Size;
+    if (periodic) {
+        // -4 pi / k^2 for the poisson equation, gaussian smoothed over the split scale and with the cloud in cell
+        // window taken out for both the deposit and the interpolation
+        double volume = spacing.x * spacing.y * spacing.z * (double)Cells();
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = 0; j < n; j++) {
+                for (size_t k = 0; k < n; k++) {
+                    double sx = (double)(i < n / 2 ? (int64_t)i : (int64_t)i - (int64_t)n);
+                    double sy = (double)(j < n / 2 ? (int64_t)j : (int64_t)j - (int64_t)n);
+                    double sz = (double)(k < n / 2 ? (int64_t)k : (int64_t)k - (int64_t)n);
+                    glm::dvec3 wave = 2.0 * pi * glm::dvec3(sx / period.x, sy / period.y, sz / period.z);
+                    double k2 = glm::dot(wave, wave);
+                    double window = m_Window[i] * m_Window[j] * m_Window[k];
+                    m_Green[Index(i, j, k)] = k2 == 0.0 ? 0.0 : -4.0 * pi * std::exp(-k2 * m_Split * m_Split) / (k2 * volume * window * window);
+                }
+            }
+        }
+        return false;
+    }
+    // the smoothed potential of a unit mass at every mesh offset, read through the nearest image of the doubled mesh,
+    // the workers transform it before StoreGreen keeps it
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            for (size_t k = 0; k < n; k++) {
+                glm::dvec3 d = spacing * glm::dvec3((double)std::min(i, n - i), (double)std::min(j, n - j), (double)std::min(k, n - k));
+                double r = glm::length(d);
+                double g = r > 0.0 ? -std::erf(r / (2.0 * m_Split)) / r : -1.0 / (m_Split * std::sqrt(pi));
+                m_Mesh[Index(i, j, k)] = { g, 0.0 };
+            }
+        }
+    }
+    return true;
+}
+
+void ParticleMesh::StoreGreen() {
+    // the transformed kernel is real since it is even, fold in the inverse scaling and the cloud in cell windows
+    size_t n = m_Size;
+    double scale = 1.0 / (double)Cells();
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            for (size_t k = 0; k < n; k++) {
+                double window = m_Window[i] * m_Window[j] * m_Window[k];
+                m_Green[Index(i, j, k)] = scale * m_Mesh[Index(i, j, k)].real() / (window * window);
+            }
+        }
+    }
+}
+
+void ParticleMesh::Layout(uint32_t resolution, size_t workers) {
+    size_t size = m_Periodic ? resolution : 2 * (size_t)resolution;
+    if (size != m_Size || resolution != m_Resolution) {
+        const double pi = 3.14159265358979323846;
+        m_Resolution = resolution;
+        m_Size = size;
+        m_Mesh.assign(Cells(), { 0.0, 0.0 });
+        m_Green.assign(Cells(), 0.0);
+        for (int32_t k = 0; k < 3; k++) m_Force[k].assign(Interior(), 0.0);
+        m_Twiddles.resize(size / 2);
+        for (size_t k = 0; k < size / 2; k++) m_Twiddles[k] = std::polar(1.0, -2.0 * pi * (double)k / (double)size);
+        m_Reversal.resize(size);
+        size_t bits = 0;
+        while (((size_t)1 << bits) < size) bits++;
+        for (size_t i = 0; i < size; i++) {
+            uint32_t reversed = 0;
+            for (size_t b = 0; b < bits; b++)
+                if (i & ((size_t)1 << b)) reversed |= 1u << (bits - 1 - b);
+            m_Reversal[i] = reversed;
+        }
+        // the cloud in cell assignment smooths every axis by sinc^2 of the mode
+        m_Window.resize(size);
+        for (size_t i = 0; i < size; i++) {
+            double s = (double)(i < size / 2 ? (int64_t)i : (int64_t)i - (int64_t)size);
+            double x = pi * s / (double)size;
+            double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+            m_Window[i] = sinc * sinc;
+        }
+    }
+    // one deposit per worker, zeroed here since a worker may steal any number of particle ranges
+    if (m_Deposits.size() != workers) m_Deposits.resize(workers);
+    for (std::vector<double>& deposit : m_Deposits) deposit.assign(Interior(), 0.0);
+    if (m_Lines.size() != workers) m_Lines.resize(workers);
+    for (std::vector<std::complex<double>>& line : m_Lines) line.resize(size);
+}
+
+void ParticleMesh::Cell(double position, int32_t axis, int32_t* index, double* fraction) {
+    double u = (position - m_Origin[axis]) / m_Spacing[axis];
+    double cell = std::floor(u);
+    *fraction = u - cell;
+    *index = (int32_t)cell;
+    if (!m_Periodic) {
+        // the margin keeps every particle inside, this only guards against a stale spacing
+        *index = std::max(0, std::min(*index, (int32_t)m_Resolution - 2));
+        *fraction = std::max(0.0, std::min(*fraction, 1.0));
+    }
+}
+
+void ParticleMesh::Deposit(size_t begin, size_t end, size_t worker) {
+    std::vector<double>& deposit = m_Deposits[worker];
+    ParticleSoA& s = *m_Particles;
+    for (size_t i = begin; i < end; i++) {
+        int32_t c[3];
+        double f[3];
+        Cell(m_UnitSize * s.px[i], 0, &c[0], &f[0]);
+        Cell(m_UnitSize * s.py[i], 1, &c[1], &f[1]);
+        Cell(m_UnitSize * s.pz[i], 2, &c[2], &f[2]);
+        for (int32_t corner = 0; corner < 8; corner++) {
+            int32_t d[3] = { corner & 1, (corner >> 1) & 1, (corner >> 2) & 1 };
+            double w = (d[0] ? f[0] : 1.0 - f[0]) * (d[1] ? f[1] : 1.0 - f[1]) * (d[2] ? f[2] : 1.0 - f[2]);
+            deposit[Inner(Wrap(c[0] + d[0]), Wrap(c[1] + d[1]), Wrap(c[2] + d[2]))] += s.mass[i] * w;
+        }
+    }
+}
+
+void ParticleMesh::Gather(size_t begin, size_t end) {
+    // sum the worker deposits into the transform mesh, clearing the padding the last solve left behind
+    size_t n = m_Size;
+    size_t x = begin / (n * n);
+    size_t y = (begin / n) % n;
+    size_t z = begin % n;
+    for (size_t c = begin; c < end; c++) {
+        double sum = 0.0;
+        if (x < m_Resolution && y < m_Resolution && z < m_Resolution) {
+            size_t inner = Inner(x, y, z);
+            for (const std::vector<double>& deposit : m_Deposits) sum += deposit[inner];
+        }
+        m_Mesh[c] = { sum, 0.0 };
+        if (++z == n) {
+            z = 0;
+            if (++y == n) {
+                y = 0;
+                x++;
+            }
+        }
+    }
+}
+
+void ParticleMesh::Transform(size_t begin, size_t end, size_t worker) {
+    // one line along the pass axis per task, copied out so the butterflies run on contiguous memory
+    std::vector<std::complex<double>>& line = m_Lines[worker];
+    size_t n = m_Size;
+    // a padded mesh is empty outside the first octant until the earlier forward passes spread it, and the
+    // inverse passes only have to bring back the first octant and the halo the gradient stencil reaches into
+    size_t reach = m_Inverse ? MESH_HALO : 0;
+    auto outside = [this, n, reach](size_t index) { return index >= m_Resolution + reach && index + reach < n; };
+    for (size_t l = begin; l < end; l++) {
+        size_t a = l / n;
+        size_t b = l % n;
+        if (m_Padded && !m_Periodic && ((m_Axis == 2 && (outside(a) || outside(b))) || (m_Axis == 1 && outside(a)))) continue;
+        size_t base = m_Axis == 2 ? l * n : (m_Axis == 1 ? a * n * n + b : a * n + b);
+        size_t stride = m_Axis == 2 ? 1 : (m_Axis == 1 ? n : n * n);
+        for (size_t k = 0; k < n; k++) line[k] = m_Mesh[base + k * stride];
+        FFT(line.data(), n, m_Twiddles, m_Reversal, m_Inverse);
+        for (size_t k = 0; k < n; k++) m_Mesh[base + k * stride] = line[k];
+    }
+}
+
+void ParticleMesh::Convolve(size_t begin, size_t end) {
+    for (size_t c = begin; c < end; c++) m_Mesh[c] *= m_Green[c];
+}
+
+void ParticleMesh::Differentiate(size_t begin, size_t end) {
+    // four point central differences of the potential, on an open mesh the stencil reaches into the
+    // MESH_HALO cells on either side of the first octant that the inverse passes bring back
+    int64_t r = m_Resolution;
+    int64_t x = (int64_t)begin / (r * r);
+    int64_t y = ((int64_t)begin / r) % r;
+    int64_t z = (int64_t)begin % r;
+    size_t px[5], py[5], pz[5];
+    auto neighbours = [this](int64_t center, size_t* wrapped) { for (int64_t o = -2; o <= 2; o++) wrapped[o + 2] = Wrap(center + o); };
+    neighbours(x, px);
+    neighbours(y, py);
+    neighbours(z, pz);
+    auto potential = [this](size_t x, size_t y, size_t z) { return m_Mesh[Index(x, y, z)].real(); };
+    for (size_t c = begin; c < end; c++) {
+        double gx = (2.0 / 3.0) * (potential(px[3], py[2], pz[2]) - potential(px[1], py[2], pz[2])) - (1.0 / 12.0) * (potential(px[4], py[2], pz[2]) - potential(px[0], py[2], pz[2]));
+        double gy = (2.0 / 3.0) * (potential(px[2], py[3], pz[2]) - potential(px[2], py[1], pz[2])) - (1.0 / 12.0) * (potential(px[2], py[4], pz[2]) - potential(px[2], py[0], pz[2]));
+        double gz = (2.0 / 3.0) * (potential(px[2], py[2], pz[3]) - potential(px[2], py[2], pz[1])) - (1.0 / 12.0) * (potential(px[2], py[2], pz[4]) - potential(px[2], py[2], pz[0]));
+        m_Force[0][c] = -GRAVITY * gx / m_Spacing.x;
+        m_Force[1][c] = -GRAVITY * gy / m_Spacing.y;
+        m_Force[2][c] = -GRAVITY * gz / m_Spacing.z;
+        // step the wrapped stencil along with the cell
+        if (++z == r) {
+            z = 0;
+            if (++y == r) {
+                y = 0;
+                neighbours(++x, px);
+            }
+            neighbours(y, py);
+        }
+        neighbours(z, pz);
+    }
+}
+
+void ParticleMesh::Interpolate(const std::vector<uint32_t>* targets, size_t begin, size_t end, bool add) {
+    // the same cloud in cell weights as the deposit
+    ParticleSoA& s = *m_Particles;
+    for (size_t k = begin; k < end; k++) {
+        size_t i = targets ? (*targets)[k] : k;
+        int32_t c[3];
+        double f[3];
+        Cell(m_UnitSize * s.px[i], 0, &c[0], &f[0]);
+        Cell(m_UnitSize * s.py[i], 1, &c[1], &f[1]);
+        Cell(m_UnitSize * s.pz[i], 2, &c[2], &f[2]);
+        glm::dvec3 a = { 0, 0, 0 };
+        for (int32_t corner = 0; corner < 8; corner++) {
+            int32_t d[3] = { corner & 1, (corner >> 1) & 1, (corner >> 2) & 1 };
+            double w = (d[0] ? f[0] : 1.0 - f[0]) * (d[1] ? f[1] : 1.0 - f[1]) * (d[2] ? f[2] : 1.0 - f[2]);
+            size_t inner = Inner(Wrap(c[0] + d[0]), Wrap(c[1] + d[1]), Wrap(c[2] + d[2]));
+            a += w * glm::dvec3(m_Force[0][inner], m_Force[1][inner], m_Force[2][inner]);
+        }
+        if (add) a += s.Acceleration(i);
+        s.SetAcceleration(i, a);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "Simulation/ParticleSoA.h"
+#include <glm/glm.hpp>
+#include <complex>
+#include <vector>
+
+#define MESH_MARGIN 3
+#define MESH_PADDING 0.125
+#define MESH_HALO 2
+
+// long range gravity on a mesh: cloud in cell deposit, an fft poisson solve with the force smoothed over
+// the split scale, and cloud in cell interpolation back onto the particles, open boxes pad the mesh to twice
+// its size so the transforms see no images
+class ParticleMesh {
+public:
+    bool Prepare(ParticleSoA* particles, size_t workers, uint32_t resolution, double split, double unitsize, const glm::dvec3 &lo, const glm::dvec3 &hi, const glm::dvec3 &period);
+    void StoreGreen();
+    double Split() { return m_Split; }
+    size_t Cells() { return m_Size * m_Size * m_Size; }
+    size_t Interior() { return (size_t)m_Resolution * m_Resolution * m_Resolution; }
+    size_t Lines() { return m_Size * m_Size; }
+    void SetPass(int32_t axis, bool inverse, bool padded) { m_Axis = axis; m_Inverse = inverse; m_Padded = padded; }
+public:
+    void Deposit(size_t begin, size_t end, size_t worker);
+    void Gather(size_t begin, size_t end);
+    void Transform(size_t begin, size_t end, size_t worker);
+    void Convolve(size_t begin, size_t end);
+    void Differentiate(size_t begin, size_t end);
+    void Interpolate(const std::vector<uint32_t>* targets, size_t begin, size_t end, bool add);
+private:
+    void Layout(uint32_t resolution, size_t workers);
+    void Cell(double position, int32_t axis, int32_t* index, double* fraction);
+    size_t Wrap(int64_t index) { return (size_t)((index % (int64_t)m_Size + (int64_t)m_Size) % (int64_t)m_Size); }
+    size_t Index(size_t x, size_t y, size_t z) { return (x * m_Size + y) * m_Size + z; }
+    size_t Inner(size_t x, size_t y, size_t z) { return (x * m_Resolution + y) * m_Resolution + z; }
+private:
+    ParticleSoA* m_Particles = nullptr;
+    double m_UnitSize = 1.0;
+    bool m_Periodic = false;
+    uint32_t m_Resolution = 0;
+    size_t m_Size = 0;
+    double m_Split = 0.0;
+    double m_Cells = 0.0;
+    glm::dvec3 m_Origin = { 0, 0, 0 };
+    glm::dvec3 m_Spacing = { 0, 0, 0 };
+    int32_t m_Axis = 0;
+    bool m_Inverse = false;
+    bool m_Padded = false;
+    std::vector<std::complex<double>> m_Mesh;
+    std::vector<double> m_Green;
+    std::vector<double> m_Force[3];
+    std::vector<std::vector<double>> m_Deposits;
+    std::vector<std::vector<std::complex<double>>> m_Lines;
+    std::vector<std::complex<double>> m_Twiddles;
+    std::vector<uint32_t> m_Reversal;
+    std::vector<double> m_Window;
+};
@@ -0,0 +1,25 @@
+#include "ParticleSoA.h"
+#include <algorithm>
+
+void ParticleSoA::Load(std::vector<Ref<Particle>> &particles) {
+    size_t count = particles.size();
+    for (AlignedDoubles* array : { &px, &py, &pz, &vx, &vy, &vz, &ax, &ay, &az, &mass })
+        array->assign(count, 0.0);
+    for (size_t i = 0; i < count; i++) {
+        SetPosition(i, particles[i]->Position());
+        SetVelocity(i, particles[i]->Velocity());
+        SetAcceleration(i, particles[i]->Acceleration());
+        mass[i] = particles[i]->Mass();
+    }
+}
+
+void ParticleSoA::Capture(ParticleFrame* frame, size_t begin, size_t end) {
+    // copy a range into a frame sized up front, velocities only when the frame keeps them
+    std::copy(px.begin() + begin, px.begin() + end, frame->x.begin() + begin);
+    std::copy(py.begin() + begin, py.begin() + end, frame->y.begin() + begin);
+    std::copy(pz.begin() + begin, pz.begin() + end, frame->z.begin() + begin);
+    if (!frame->velocities) return;
+    std::copy(vx.begin() + begin, vx.begin() + end, frame->vx.begin() + begin);
+    std::copy(vy.begin() + begin, vy.begin() + end, frame->vy.begin() + begin);
+    std::copy(vz.begin() + begin, vz.begin() + end, frame->vz.begin() + begin);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "Simulation/Particle.h"
+#include "Core/Safety.h"
+#include <glm/glm.hpp>
+#include <new>
+#include <vector>
+
+#define SOA_ALIGNMENT 64
+
+template<typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    AlignedAllocator() = default;
+    template<typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(SOA_ALIGNMENT))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(SOA_ALIGNMENT)); }
+    template<typename U> bool operator==(const AlignedAllocator<U> &) const { return true; }
+    template<typename U> bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+using AlignedDoubles = std::vector<double, AlignedAllocator<double>>;
+
+struct ParticleFrame {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+    std::vector<double> vx;
+    std::vector<double> vy;
+    std::vector<double> vz;
+    uint64_t step = 0;
+    bool velocities = false;
+    bool keyframe = false;
+};
+
+class ParticleSoA {
+public:
+    size_t Size() { return mass.size(); }
+    void Load(std::vector<Ref<Particle>> &particles);
+    void Capture(ParticleFrame* frame, size_t begin, size_t end);
+public:
+    glm::dvec3 Position(size_t i) { return { px[i], py[i], pz[i] }; }
+    void SetPosition(size_t i, const glm::dvec3 &p) { px[i] = p.x; py[i] = p.y; pz[i] = p.z; }
+    glm::dvec3 Velocity(size_t i) { return { vx[i], vy[i], vz[i] }; }
+    void SetVelocity(size_t i, const glm::dvec3 &v) { vx[i] = v.x; vy[i] = v.y; vz[i] = v.z; }
+    glm::dvec3 Acceleration(size_t i) { return { ax[i], ay[i], az[i] }; }
+    void SetAcceleration(size_t i, const glm::dvec3 &a) { ax[i] = a.x; ay[i] = a.y; az[i] = a.z; }
+    double Mass(size_t i) { return mass[i]; }
+public:
+    AlignedDoubles px;
+    AlignedDoubles py;
+    AlignedDoubles pz;
+    AlignedDoubles vx;
+    AlignedDoubles vy;
+    AlignedDoubles vz;
+    AlignedDoubles ax;
+    AlignedDoubles ay;
+    AlignedDoubles az;
+    AlignedDoubles mass;
+};
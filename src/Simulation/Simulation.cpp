@@ -7,6 +7,8 @@
 #include <chrono>
 #include <ctime>
 #include <cmath>
+#include <algorithm>
+#include <filesystem>
 #ifndef _WIN32
 #include <ifaddrs.h>
 #include <netinet/in.h>
@@ -82,279 +84,779 @@ bool Simulation::Paused() {
     return m_Paused; 
 }
 
+#define LAUNCH_STEP(step) m_Scheduler.stage = step; \
+	m_Scheduler.barrier.Release();
+#define SUBMIT_STEP(step, count, chunks) m_Scheduler.tasks.Submit(count, chunks); \
+	LAUNCH_STEP(step); \
+	m_Scheduler.barrier.Wait();
+#define SUBMIT_WEIGHTED_STEP(step, costs, chunks) m_Scheduler.tasks.SubmitWeighted(costs, chunks); \
+	LAUNCH_STEP(step); \
+	m_Scheduler.barrier.Wait();
+
+void Simulation::ComputeForces(bool partial) {
+	// hand each worker several chunks per stage so idle workers can steal from busy ones
+	size_t count = m_ParticleStore.Size();
+	size_t workers = m_Scheduler.metadata.size();
+	size_t chunks = workers * TASK_CHUNKS;
+	m_ForceEvaluations++;
+
+	// between block sync points only the particles closing a step need their forces
+	m_PartialForces = partial && m_Integrator.Partial();
+
+	// settle the mesh spacing first, the tree walk of treepm cuts off at a few cells of it
+	bool mesh = m_RunTechnique == SimulationTechnique::PARTICLEMESH || m_RunTechnique == SimulationTechnique::TREEPM;
+	if (mesh) {
+		glm::dvec3 lo = { m_Scheduler.bounds.xmin, m_Scheduler.bounds.ymin, m_Scheduler.bounds.zmin };
+		glm::dvec3 hi = { m_Scheduler.bounds.xmax, m_Scheduler.bounds.ymax, m_Scheduler.bounds.zmax };
+		uint32_t resolution = m_Grids.empty() ? GRID_RESOLUTION : m_Grids[0]->Resolution();
+		double split = m_Grids.empty() ? GRID_SPLIT : m_Grids[0]->Split();
+		if (m_ParticleMesh.Prepare(&m_ParticleStore, workers, resolution, split, m_UnitSize, lo, hi, Forces().period)) {
+			// a new spacing for an open mesh, transform the kernel once for every solve until the next one
+			for (int32_t axis = 2; axis >= 0; axis--) {
+				m_ParticleMesh.SetPass(axis, false, false);
+				SUBMIT_STEP(WorkerStage::PMTRANSFORM, m_ParticleMesh.Lines(), chunks);
+			}
+			m_ParticleMesh.StoreGreen();
+		}
+		m_MeshTargets.clear();
+		if (m_PartialForces && m_RunTechnique == SimulationTechnique::PARTICLEMESH) m_MeshTargets = m_Integrator.Active();
+	}
+
+	if ((m_RunTechnique == SimulationTechnique::BARNESHUT && m_RunBackend == SimulationTreeBackend::FLAT) || m_RunTechnique == SimulationTechnique::FMM || m_RunTechnique == SimulationTechnique::TREEPM) {
+		// create enough of the octtree to paralellize, growing the arena if any worker runs out of nodes
+		double xdif = ((m_Scheduler.bounds.xmax - m_Scheduler.bounds.xmin) / 2.0);
+		double ydif	= ((m_Scheduler.bounds.ymax - m_Scheduler.bounds.ymin) / 2.0);
+		double zdif	= ((m_Scheduler.bounds.zmax - m_Scheduler.bounds.zmin) / 2.0);
+		Oct space = {
+			xdif + m_Scheduler.bounds.xmin,
+			ydif + m_Scheduler.bounds.ymin,
+			zdif + m_Scheduler.bounds.zmin,
+			(xdif > ydif ? (xdif > zdif ? xdif : zdif) : (ydif > zdif ? ydif : zdif))
+		};
+		// keep last step's tree when asked to, moving only the particles that left their leaves
+		bool refitted = false;
+		if (m_TreeUpdate == SimulationTreeUpdate::REFIT) {
+			glm::dvec3 lo = { m_Scheduler.bounds.xmin, m_Scheduler.bounds.ymin, m_Scheduler.bounds.zmin };
+			glm::dvec3 hi = { m_Scheduler.bounds.xmax, m_Scheduler.bounds.ymax, m_Scheduler.bounds.zmax };
+			if (m_FlatTree.PrepareRefit(lo, hi, &m_ParticleStore)) {
+				for (size_t j = 0; j < workers; j++) m_Scheduler.metadata[j].escaped.clear();
+				SUBMIT_STEP(WorkerStage::REFIT, count, chunks);
+				m_Escaped.clear();
+				for (size_t j = 0; j < workers; j++)
+					m_Escaped.insert(m_Escaped.end(), m_Scheduler.metadata[j].escaped.begin(), m_Scheduler.metadata[j].escaped.end());
+				std::sort(m_Escaped.begin(), m_Escaped.end());
+				refitted = m_FlatTree.Reinsert(m_Escaped);
+			}
+		}
+		if (refitted) {
+			// the workers redo the moments of their own subtrees, the controller only joins the top
+			m_FlatTree.SplitTop(&m_Scheduler.nodes, chunks);
+			SUBMIT_STEP(WorkerStage::MOMENTS, m_Scheduler.nodes.size(), m_Scheduler.nodes.size());
+			m_TreeRefits++;
+		} else {
+			// leave the kept tree some room to grow into before the particles outrun its root
+			if (m_TreeUpdate == SimulationTreeUpdate::REFIT) space.radius *= 1.0 + REFIT_PADDING;
+			m_FlatTree.SetLeafSize(m_LeafSize);
+			m_FlatTree.Reset(space, &m_ParticleStore);
+			if (m_TreeConstruction == SimulationTreeConstruction::MORTON) {
+				// compute and radix sort morton keys in parallel
+				size_t sortchunks = std::min(count, chunks);
+				m_FlatTree.PrepareSort(sortchunks);
+				SUBMIT_STEP(WorkerStage::MORTON, count, chunks);
+				for (size_t pass = 0; pass < RADIX_PASSES; pass++) {
+					SUBMIT_STEP(WorkerStage::RADIXCOUNT, count, sortchunks);
+					bool scatter = m_FlatTree.PrefixDigits(sortchunks);
+					if (scatter) {
+						SUBMIT_STEP(WorkerStage::RADIXSCATTER, count, sortchunks);
+					}
+					m_FlatTree.NextRadixPass(scatter);
+				}
+			}
+			do {
+				if (m_FlatTree.Overflowed()) {
+					m_FlatTree.Grow();
+					m_FlatTree.Clear();
+				}
+				if (m_TreeConstruction == SimulationTreeConstruction::MORTON) {
+					// split the top of the sorted key range here and let the workers build the subtrees below it
+					m_FlatTree.BuildTop(&m_Scheduler.nodes, chunks);
+					m_FlatTree.MarkTop();
+					SUBMIT_STEP(WorkerStage::OCTTREE, m_Scheduler.nodes.size(), m_Scheduler.nodes.size());
+					continue;
+				}
+				size_t ignoreind = 0;
+				while (m_FlatTree.Leaves() < chunks && ignoreind < count) {
+					m_FlatTree.Insert((int32_t)ignoreind);
+					ignoreind++;
+				}
+
+				// parallelize the rest of the octtree creation
+				m_Scheduler.nodes.clear();
+				m_FlatTree.GetLeaves(&m_Scheduler.nodes);
+				m_FlatTree.MarkTop();
+				m_Scheduler.ignore = ignoreind;
+				SUBMIT_STEP(WorkerStage::OCTTREE, m_Scheduler.nodes.size(), m_Scheduler.nodes.size());
+			} while (m_FlatTree.Overflowed());
+			m_FlatTree.MarkBuilt();
+			m_TreeRebuilds++;
+		}
+
+		m_FlatTree.CombineTop();
+		if (m_RunTechnique == SimulationTechnique::FMM) {
+			// hand out disjoint subtrees, the controller only joins the multipoles above them
+			m_FastMultipole.SetOrder(m_ExpansionOrder);
+			m_FastMultipole.Prepare(&m_FlatTree, chunks, m_UnitSize, Forces());
+			size_t tasks = m_FastMultipole.Tasks().size();
+			SUBMIT_STEP(WorkerStage::FMMUPWARD, tasks, tasks);
+			m_FastMultipole.UpwardTop();
+			SUBMIT_STEP(WorkerStage::FMMINTERACT, tasks, tasks);
+			SUBMIT_STEP(WorkerStage::FMMDOWNWARD, tasks, tasks);
+		} else {
+			// apply octtree over groups of neighbouring particles
+			m_FlatTree.CollectGroups();
+			m_Targets.clear();
+			m_Costs.clear();
+			for (size_t g = 0; g < m_FlatTree.Groups().size(); g++) {
+				m_GroupParticles.clear();
+				m_FlatTree.GatherParticles(m_FlatTree.Groups()[g], &m_GroupParticles);
+				uint64_t cost = 0;
+				bool active = !m_PartialForces;
+				for (uint32_t p : m_GroupParticles) {
+					cost += m_Interactions[p];
+					active = active || m_Integrator.IsActive(p);
+				}
+				if (!active) continue;
+				// the mesh has to add to every particle the walk overwrites, not just the active ones
+				if (m_PartialForces && mesh) m_MeshTargets.insert(m_MeshTargets.end(), m_GroupParticles.begin(), m_GroupParticles.end());
+				m_Targets.push_back((uint32_t)g);
+				m_Costs.push_back(cost);
+			}
+			for (size_t j = 0; j < workers; j++) m_Scheduler.metadata[j].interactions = 0;
+			SUBMIT_WEIGHTED_STEP(WorkerStage::APPLY, m_Costs, chunks);
+		}
+	} else if (m_RunTechnique == SimulationTechnique::BARNESHUT) {
+		// create enough of the octtree to paralellize
+		double xdif = ((m_Scheduler.bounds.xmax - m_Scheduler.bounds.xmin) / 2.0);
+		double ydif	= ((m_Scheduler.bounds.ymax - m_Scheduler.bounds.ymin) / 2.0);
+		double zdif	= ((m_Scheduler.bounds.zmax - m_Scheduler.bounds.zmin) / 2.0);
+		Oct space = {
+			xdif + m_Scheduler.bounds.xmin,
+			ydif + m_Scheduler.bounds.ymin,
+			zdif + m_Scheduler.bounds.zmin,
+			(xdif > ydif ? (xdif > zdif ? xdif : zdif) : (ydif > zdif ? ydif : zdif))
+		};
+		for (size_t j = 0; j < count; j++) m_ParticleSlice[j].SetPosition(m_ParticleStore.Position(j));
+		size_t treesize = 0;
+		size_t ignoreind = 0;
+		Octtree tree(space, &treesize, std::max(m_LeafSize, 1u));
+		while (treesize < chunks && ignoreind < count) {
+			tree.Insert(&m_ParticleSlice[ignoreind]);
+			ignoreind++;
+		}
+
+		// parallelize the rest of the octtree creation
+		m_Scheduler.trees.clear();
+		tree.GetLeaves(&m_Scheduler.trees);
+		for (Octtree* leaf : m_Scheduler.trees) leaf->m_SizeRef = nullptr;
+		m_Scheduler.ignore = ignoreind;
+		SUBMIT_STEP(WorkerStage::OCTTREE, m_Scheduler.trees.size(), m_Scheduler.trees.size());
+
+		// apply quadtree, the workers already did the moments below the leaves they were handed
+		tree.CalculateTopCenterOfMass();
+		m_Scheduler.root = &tree;
+		for (size_t j = 0; j < workers; j++) m_Scheduler.metadata[j].interactions = 0;
+		if (m_PartialForces) {
+			m_Targets = m_Integrator.Active();
+		} else {
+			m_Targets.resize(count);
+			for (size_t j = 0; j < count; j++) m_Targets[j] = (uint32_t)j;
+		}
+		m_Costs.resize(m_Targets.size());
+		for (size_t k = 0; k < m_Targets.size(); k++) m_Costs[k] = m_Interactions[m_Targets[k]];
+		SUBMIT_WEIGHTED_STEP(WorkerStage::APPLY, m_Costs, chunks);
+		for (uint32_t j : m_Targets) m_ParticleStore.SetAcceleration(j, m_ParticleSlice[j].Acceleration());
+	} else if (m_RunTechnique == SimulationTechnique::EDGE || m_RunTechnique == SimulationTechnique::PARTICLE) {
+		// sum every pair directly over packed tiles
+		auto start = std::chrono::steady_clock::now();
+		// a few active targets are cheaper one sided than the symmetric sweep over every pair
+		bool edges = m_RunTechnique == SimulationTechnique::EDGE && !m_PartialForces;
+		size_t targets = m_PartialForces ? m_Integrator.Active().size() : count;
+		m_DirectSum.Prepare(&m_ParticleStore, edges ? workers : 0, m_UnitSize, m_Precision == SimulationPrecision::MIXED, m_Softening, Forces().period);
+		SUBMIT_STEP(WorkerStage::DIRECT, edges ? m_DirectSum.TilePairs() : targets, chunks);
+		if (edges) {
+			SUBMIT_STEP(WorkerStage::REDUCE, count, chunks);
+		}
+		m_DirectSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		m_DirectInteractions += (double)targets * (double)count;
+	} else if (m_RunTechnique != SimulationTechnique::PARTICLEMESH) {
+		FATAL("Unhandled technique");
+	}
+
+	if (mesh) {
+		// spread the mass over the mesh, solve for the potential in fourier space and pull each target back off its gradient,
+		// on top of the short range forces the tree already left for treepm
+		SUBMIT_STEP(WorkerStage::PMDEPOSIT, count, chunks);
+		SUBMIT_STEP(WorkerStage::PMGATHER, m_ParticleMesh.Cells(), chunks);
+		for (int32_t axis = 2; axis >= 0; axis--) {
+			m_ParticleMesh.SetPass(axis, false, true);
+			SUBMIT_STEP(WorkerStage::PMTRANSFORM, m_ParticleMesh.Lines(), chunks);
+		}
+		SUBMIT_STEP(WorkerStage::PMCONVOLVE, m_ParticleMesh.Cells(), chunks);
+		for (int32_t axis = 0; axis < 3; axis++) {
+			m_ParticleMesh.SetPass(axis, true, true);
+			SUBMIT_STEP(WorkerStage::PMTRANSFORM, m_ParticleMesh.Lines(), chunks);
+		}
+		SUBMIT_STEP(WorkerStage::PMGRADIENT, m_ParticleMesh.Interior(), chunks);
+		SUBMIT_STEP(WorkerStage::PMINTERPOLATE, m_PartialForces ? m_MeshTargets.size() : count, chunks);
+	}
+
+	// keep track of how evenly the force walk was spread over the workers
+	if (m_RunTechnique == SimulationTechnique::BARNESHUT || m_RunTechnique == SimulationTechnique::TREEPM) {
+		uint64_t most = 0;
+		for (size_t j = 0; j < workers; j++) {
+			m_StepInteractions += m_Scheduler.metadata[j].interactions;
+			most = std::max(most, m_Scheduler.metadata[j].interactions);
+		}
+		m_StepBusiest += most;
+	}
+}
+
+void Simulation::Integrate(IntegratorPass pass, double step, size_t stage) {
+	size_t workers = m_Scheduler.metadata.size();
+	m_Integrator.Set(pass, step, stage);
+	for (size_t j = 0; j < workers; j++) {
+		m_Scheduler.metadata[j].bounds.Reset();
+		m_Scheduler.metadata[j].error.Reset();
+	}
+	SUBMIT_STEP(WorkerStage::UPDATE, m_Integrator.Targets(), workers * TASK_CHUNKS);
+	if (!m_Integrator.Moves()) return;
+
+	// recalculate overall bounds so the next tree build contains every particle
+	m_Scheduler.bounds.Reset();
+	for (size_t j = 0; j < workers; j++) {
+		BoundaryData b = m_Scheduler.metadata[j].bounds;
+		if (b.xmin - 0.001 < m_Scheduler.bounds.xmin) m_Scheduler.bounds.xmin = b.xmin - 0.001;
+		if (b.ymin - 0.001 < m_Scheduler.bounds.ymin) m_Scheduler.bounds.ymin = b.ymin - 0.001;
+		if (b.zmin - 0.001 < m_Scheduler.bounds.zmin) m_Scheduler.bounds.zmin = b.zmin - 0.001;
+		if (b.xmax + 0.001 > m_Scheduler.bounds.xmax) m_Scheduler.bounds.xmax = b.xmax + 0.001;
+		if (b.ymax + 0.001 > m_Scheduler.bounds.ymax) m_Scheduler.bounds.ymax = b.ymax + 0.001;
+		if (b.zmax + 0.001 > m_Scheduler.bounds.zmax) m_Scheduler.bounds.zmax = b.zmax + 0.001;
+	}
+}
+
+void Simulation::WrapPositions(size_t begin, size_t end) {
+	// particles leaving the periodic box come back in through the opposite face, it spans half the bounds either side of the origin
+	ParticleSoA& s = m_ParticleStore;
+	for (size_t i = begin; i < end; i++) {
+		s.px[i] -= m_Bounds.x * std::floor(s.px[i] / m_Bounds.x + 0.5);
+		s.py[i] -= m_Bounds.y * std::floor(s.py[i] / m_Bounds.y + 0.5);
+		s.pz[i] -= m_Bounds.z * std::floor(s.pz[i] / m_Bounds.z + 0.5);
+	}
+}
+
+void Simulation::CaptureFrame(uint64_t step, bool keyframe) {
+	// the workers copy the step into a free snapshot slot, the writer thread stores it while the next step runs
+	size_t workers = m_Scheduler.metadata.size();
+	m_CaptureFrame = m_TrajectoryWriter.Acquire(step, keyframe);
+	SUBMIT_STEP(WorkerStage::CAPTURE, m_ParticleStore.Size(), workers * TASK_CHUNKS);
+	m_TrajectoryWriter.Publish();
+	m_RecordClock = std::chrono::steady_clock::now();
+}
+
+bool Simulation::RecordDue(uint64_t step) {
+	// a disabled record keeps just the first and last steps and any keyframes
+	if (!m_EnableSimulationRecord) return false;
+	switch (m_RecordPolicy) {
+		case SimulationRecordPolicy::STEPS:
+			return step % std::max(m_RecordInterval, (uint64_t)1) == 0;
+		case SimulationRecordPolicy::WALLCLOCK:
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_RecordClock).count() >= m_RecordSeconds;
+		case SimulationRecordPolicy::DISPLACEMENT: {
+			// record once any particle has moved the threshold away from where the last frame left it
+			size_t workers = m_Scheduler.metadata.size();
+			for (size_t j = 0; j < workers; j++) m_Scheduler.metadata[j].displacement = 0.0;
+			SUBMIT_STEP(WorkerStage::DISPLACEMENT, m_ParticleStore.Size(), workers * TASK_CHUNKS);
+			double farthest = 0.0;
+			for (size_t j = 0; j < workers; j++) farthest = std::max(farthest, m_Scheduler.metadata[j].displacement);
+			return farthest >= m_RecordDisplacement * m_RecordDisplacement;
+		}
+		default: FATAL("Unhandled record policy");
+	}
+	return true;
+}
+
+void Simulation::MeasureDisplacement(size_t begin, size_t end, double* farthest) {
+	// squared distances, measured through the nearest image when the box is periodic
+	ParticleSoA& s = m_ParticleStore;
+	ParticleFrame& reference = m_RecordReference;
+	for (size_t i = begin; i < end; i++) {
+		double dx = s.px[i] - reference.x[i];
+		double dy = s.py[i] - reference.y[i];
+		double dz = s.pz[i] - reference.z[i];
+		if (m_Periodic) {
+			dx -= m_Bounds.x * std::floor(dx / m_Bounds.x + 0.5);
+			dy -= m_Bounds.y * std::floor(dy / m_Bounds.y + 0.5);
+			dz -= m_Bounds.z * std::floor(dz / m_Bounds.z + 0.5);
+		}
+		*farthest = std::max(*farthest, dx * dx + dy * dy + dz * dz);
+	}
+}
+
+void Simulation::DropTrajectory() {
+	// trajectories only live as long as the run they play back
+	if (!m_Trajectory.IsOpen()) return;
+	std::string path = m_Trajectory.Path();
+	m_Trajectory.Close();
+	std::error_code error;
+	std::filesystem::remove(path, error);
+}
+
+uint64_t Simulation::Fingerprint() {
+	// fnv-1a over the starting particles and the settings that shape the run, so edits never resume a stale checkpoint
+	uint64_t hash = 0xcbf29ce484222325ull;
+	auto mix = [&hash](const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++) hash = (hash ^ ((const uint8_t*)data)[i]) * 0x100000001b3ull;
+	};
+	for (Ref<Particle>& particle : m_Particles) {
+		glm::dvec3 position = particle->Position();
+		glm::dvec3 velocity = particle->Velocity();
+		double mass = particle->Mass();
+		mix(&position, sizeof(position));
+		mix(&velocity, sizeof(velocity));
+		mix(&mass, sizeof(mass));
+	}
+	mix(&m_SimulationLength, sizeof(m_SimulationLength));
+	mix(&m_Timestep, sizeof(m_Timestep));
+	mix(&m_DynamicTimestep, sizeof(m_DynamicTimestep));
+	mix(&m_UnitSize, sizeof(m_UnitSize));
+	mix(&m_Solver, sizeof(m_Solver));
+	mix(&m_SolverTolerance, sizeof(m_SolverTolerance));
+	mix(&m_RunTechnique, sizeof(m_RunTechnique));
+	mix(&m_RunBackend, sizeof(m_RunBackend));
+	mix(&m_TreeConstruction, sizeof(m_TreeConstruction));
+	mix(&m_TreeUpdate, sizeof(m_TreeUpdate));
+	mix(&m_LeafSize, sizeof(m_LeafSize));
+	mix(&m_Opening, sizeof(m_Opening));
+	mix(&m_Theta, sizeof(m_Theta));
+	mix(&m_Softening, sizeof(m_Softening));
+	mix(&m_Multipole, sizeof(m_Multipole));
+	mix(&m_ExpansionOrder, sizeof(m_ExpansionOrder));
+	mix(&m_Precision, sizeof(m_Precision));
+	mix(&m_Periodic, sizeof(m_Periodic));
+	if (m_Periodic) mix(&m_Bounds, sizeof(m_Bounds));
+	if (!m_Grids.empty()) {
+		uint32_t resolution = m_Grids[0]->Resolution();
+		double split = m_Grids[0]->Split();
+		mix(&resolution, sizeof(resolution));
+		mix(&split, sizeof(split));
+	}
+	return hash;
+}
+
+std::string Simulation::CheckpointPath() {
+	// named after the simulation file so a restarted editor finds it again, and after the fingerprint so scenes
+	// sharing a name, or never saved at all, keep their checkpoints apart
+	std::string name = m_Filepath.empty() ? "untitled" : std::filesystem::path(m_Filepath).stem().string();
+	std::stringstream path;
+	path << CHECKPOINT_DIRECTORY << "/" << name << "_" << std::hex << std::setw(16) << std::setfill('0') << m_Origin << ".ckpt";
+	return path.str();
+}
+
+bool Simulation::FindCheckpoint(CheckpointReader &checkpoint) {
+	if (!checkpoint.Open(CheckpointPath())) return false;
+	const CheckpointHeader& header = checkpoint.Header();
+	if (header.origin != m_Origin || header.particles != m_Particles.size()) {
+		this->Log("ignoring a checkpoint left by a different scene or settings");
+		return false;
+	}
+	return header.step < header.steps;
+}
+
+bool Simulation::RestoreKeyframe(uint64_t frame) {
+	// walk back to the nearest keyframe and hand its state to the editor particles, the next run starts from there
+	if (!m_Trajectory.IsOpen() || m_Trajectory.Frames() == 0 || m_Trajectory.Particles() != m_Particles.size()) return false;
+	for (uint64_t f = std::min(frame, m_Trajectory.Frames() - 1) + 1; f-- > 0;) {
+		if (!m_Trajectory.IsKeyframe(f)) continue;
+		m_Trajectory.Seek(f);
+		for (size_t i = 0; i < m_Particles.size(); i++) {
+			m_Particles[i]->SetPosition(m_Trajectory.Position(i));
+			m_Particles[i]->SetVelocity(m_Trajectory.Velocity(i));
+		}
+		this->Log("restored the keyframe at step " + std::to_string(m_Trajectory.Step()));
+		return true;
+	}
+	return false;
+}
+
 void Simulation::SimulateLocal() {
-	#define WAIT_ON_WORKERS() for (size_t j = 0; j < m_Scheduler.metadata.size(); j++) { \
-		std::unique_lock<std::mutex> lock(m_Scheduler.lock); \
-		m_Scheduler.controller_alert.wait(lock, [this, &j] { return m_Scheduler.metadata[j].finished; }); \
-	}
-	#define LAUNCH_NAIVE_STEP(step)	m_Scheduler.lock.lock(); for (size_t j = 0; j < m_Scheduler.metadata.size(); j++) { \
-		m_Scheduler.metadata[j].finished = false; \
-		m_Scheduler.metadata[j].stage = step; \
-		m_Scheduler.worker_alerts[j]->notify_all(); \
-	} m_Scheduler.lock.unlock();
-	#define LAUNCH_UPDATE_STEP(step) m_Scheduler.lock.lock(); for (size_t j = 0; j < m_Scheduler.metadata.size(); j++) { \
-		if (m_Scheduler.metadata[j].particles.index == 0 && m_Scheduler.metadata[j].particles.size == 0) continue; \
-		m_Scheduler.metadata[j].finished = false; \
-		m_Scheduler.metadata[j].stage = step; \
-		m_Scheduler.worker_alerts[j]->notify_all(); \
-	} m_Scheduler.lock.unlock();
-	#define RESET_METADATA_TREES(trees) { \
-		trees[0] = nullptr; \
-		trees[1] = nullptr; \
-		trees[2] = nullptr; \
-		trees[3] = nullptr; \
-		trees[4] = nullptr; \
-		trees[5] = nullptr; \
-		trees[6] = nullptr; \
-		trees[7] = nullptr; \
-	}
-
-	// set up simulation progress and current particle slice
-	std::vector<std::vector<Particle>> simulation_progress;
+	// stream simulation progress to the trajectory file, starting from the run time particle store
+	size_t count = m_ParticleStore.Size();
+	std::vector<double> radii(count);
+	for (size_t i = 0; i < count; i++) radii[i] = m_Particles[i]->Radius();
+	m_TrajectoryWriter.Open(m_TrajectoryPath, radii, m_RecordVelocities, (double)m_Timestep, m_UnitSize, m_RecordTolerance, m_Resume.step);
+	if (m_TrajectoryWriter.Frames() > 0) this->Log("appending to the trajectory after its " + std::to_string(m_TrajectoryWriter.Frames()) + " frames before the checkpoint");
+
+	// the adaptive policy measures how far particles moved from the last recorded frame
+	bool displacement = m_EnableSimulationRecord && m_RecordPolicy == SimulationRecordPolicy::DISPLACEMENT;
+	m_RecordReference.x.resize(displacement ? count : 0);
+	m_RecordReference.y.resize(displacement ? count : 0);
+	m_RecordReference.z.resize(displacement ? count : 0);
+	CaptureFrame(m_Resume.step, m_KeyframeInterval > 0);
+
+	// the pointer octtree links editor particles, so it works on a mirror of the store
+	bool mirror = m_RunTechnique == SimulationTechnique::BARNESHUT && m_RunBackend == SimulationTreeBackend::POINTER;
 	m_ParticleSlice.clear();
-	for (size_t i = 0; i < m_Particles.size(); i++) m_ParticleSlice.push_back(*m_Particles[i]);
-	simulation_progress.push_back(m_ParticleSlice);
+	if (mirror) for (size_t i = 0; i < m_Particles.size(); i++) m_ParticleSlice.push_back(*m_Particles[i]);
 
 	// set up steps and unitsize
 	uint64_t steps = m_SimulationLength / m_Timestep;
 	if (m_UnitSize <= 0) m_UnitSize = EPS;
+	if (m_Periodic && m_RunTechnique == SimulationTechnique::BARNESHUT) m_Ewald.Prepare(m_Bounds * m_UnitSize, EWALD_CACHE_DIRECTORY);
+	double timestep = (double)m_Timestep;
 
-	// mutex lock and wait for all subprocesses to be ready
-	while (true) {
-		bool verified = true;
-		for (size_t i = 0; i < m_Scheduler.metadata.size(); i++) {
-			m_Scheduler.lock.lock();
-			if (!m_Scheduler.metadata[i].finished) verified = false;
-			m_Scheduler.lock.unlock();
-			if (!verified) break;
-		}
-		if (verified) break;
-	} 
+	// interactions per particle from the previous force walk, used to cut equal cost chunks
+	m_Interactions.assign(count, 1);
+
+	// reset force evaluation and direct summation statistics
+	m_ForceEvaluations = 0;
+	m_DirectSeconds = 0.0;
+	m_DirectInteractions = 0.0;
+	m_TreeRefits = 0;
+	m_TreeRebuilds = 0;
+	m_FlatTree.Invalidate();
+
+	// the adaptive solver carries its step size across output steps, and across a restart through the checkpoint
+	m_Integrator.Prepare(&m_ParticleStore, m_UnitSize, m_Solver == SimulationSolver::RKF45);
+	// errors are scaled per component, with a softening length, or a softening length per recorded step, as the absolute floor
+	m_Integrator.SetTolerance(m_SolverTolerance, m_SolverTolerance * m_Softening / m_UnitSize, m_SolverTolerance * m_Softening / m_UnitSize / timestep);
+	double adaptive_step = m_Resume.step > 0 ? m_Resume.adaptive : timestep;
+	uint64_t accepted_steps = m_Resume.accepted;
+	uint64_t rejected_steps = m_Resume.rejected;
+
+	// checkpoints keep a long run recoverable, the first one waits a full interval
+	std::chrono::steady_clock::time_point checkpoint_clock = std::chrono::steady_clock::now();
+	uint64_t checkpoints = 0;
+
+	// dynamic timesteps give each particle its own power of two fraction of the recorded step
+	bool blocks = m_DynamicTimestep && m_Solver == SimulationSolver::LEAPFROG;
+	if (m_DynamicTimestep && !blocks) this->Log("dynamic timesteps need the leapfrog solver, stepping every particle together");
+	if (blocks) m_Integrator.PrepareBlocks(m_Softening / m_UnitSize);
+	uint64_t block_steps = 0;
+	uint64_t block_active = 0;
+	uint32_t block_finest = 0;
+
+	// the symplectic solvers are all chains of kicks and drifts
+	bool composed = true;
+	switch (m_Solver) {
+		case SimulationSolver::LEAPFROG: m_Integrator.Compose(Composition::LEAPFROG); break;
+		case SimulationSolver::FORESTRUTH: m_Integrator.Compose(Composition::FORESTRUTH); break;
+		case SimulationSolver::YOSHIDA4: m_Integrator.Compose(Composition::YOSHIDA4); break;
+		case SimulationSolver::YOSHIDA6: m_Integrator.Compose(Composition::YOSHIDA6); break;
+		default: composed = false; break;
+	}
+
+	// they open each step with the forces from the end of the previous one
+	if (composed && steps > m_Resume.step) ComputeForces();
+
+	// busiest worker against the average on each step that walked a tree, logged at a throttled cadence and summarized once the run is over
+	double imbalance_total = 0.0;
+	double imbalance_worst = 0.0;
+	uint64_t imbalance_steps = 0;
 
 	// simulate over a loop
-	for (uint64_t i = 0; i < steps; i++) {
-		if (m_Technique == SimulationTechnique::BARNESHUT) {
-			// create enough of the octtree to paralellize
-			double xdif = ((m_Scheduler.bounds.xmax - m_Scheduler.bounds.xmin) / 2.0);
-			double ydif	= ((m_Scheduler.bounds.ymax - m_Scheduler.bounds.ymin) / 2.0);
-			double zdif	= ((m_Scheduler.bounds.zmax - m_Scheduler.bounds.zmin) / 2.0);
-			Oct space = {
-				xdif + m_Scheduler.bounds.xmin,
-				ydif + m_Scheduler.bounds.ymin,
-				zdif + m_Scheduler.bounds.zmin,
-				(xdif > ydif ? (xdif > zdif ? xdif : zdif) : (ydif > zdif ? ydif : zdif))
-			};
-			size_t treesize = 0;
-			size_t ignoreind = 0;
-			Octtree tree(space, &treesize);
-			while (treesize < m_NumLocalWorkers) {
-				tree.Insert(&m_ParticleSlice[ignoreind]);
-				ignoreind++;
+	for (uint64_t i = m_Resume.step; i < steps; i++) {
+		m_StepInteractions = 0;
+		m_StepBusiest = 0;
+		if (m_Solver == SimulationSolver::EULER) {
+			ComputeForces();
+			Integrate(IntegratorPass::EULER, timestep);
+		} else if (blocks) {
+			// everyone is in sync at a recorded step, so every particle opens a new step here
+			uint64_t tick = 0;
+			m_Integrator.SetTick(tick);
+			m_Integrator.ActivateAll();
+			Integrate(IntegratorPass::OPEN, timestep);
+			block_finest = std::max(block_finest, m_Integrator.FinestLevel());
+			while (tick < BLOCK_TICKS) {
+				// drift everyone to the next block boundary and kick only the particles whose steps end there
+				uint64_t next = m_Integrator.Advance();
+				Integrate(IntegratorPass::DRIFT, timestep * (double)(next - tick) / (double)BLOCK_TICKS);
+				tick = next;
+				m_Integrator.SetTick(tick);
+				ComputeForces(true);
+				Integrate(IntegratorPass::CLOSE, timestep);
+				if (tick < BLOCK_TICKS) Integrate(IntegratorPass::OPEN, timestep);
+				block_finest = std::max(block_finest, m_Integrator.FinestLevel());
+				block_active += m_Integrator.Active().size();
+				block_steps++;
 			}
-
-			// parallelize the rest of the octtree creation
-			std::vector<Octtree*> leaves;
-			tree.GetLeaves(&leaves);
-			m_Scheduler.lock.lock();
-			for (size_t j = 0; j < leaves.size(); j++) {
-				if (j == m_NumLocalWorkers - 1) {
-					RESET_METADATA_TREES(m_Scheduler.metadata[j].trees);
-					for (size_t k = j; k < leaves.size(); k++) {
-						leaves[k]->m_SizeRef = nullptr;
-						m_Scheduler.metadata[j].trees[k - j] = leaves[k];
-					}
-					m_Scheduler.metadata[j].ignore = ignoreind;
-					m_Scheduler.metadata[j].finished = false;
-					m_Scheduler.metadata[j].stage = WorkerStage::OCTTREE;
-					m_Scheduler.worker_alerts[j]->notify_all();
-					break;
+		} else if (composed) {
+			for (size_t k = 0; k < m_Integrator.Drifts(); k++) {
+				Integrate(IntegratorPass::KICK, m_Integrator.Kick(k) * timestep);
+				Integrate(IntegratorPass::DRIFT, m_Integrator.Drift(k) * timestep);
+				ComputeForces();
+			}
+			Integrate(IntegratorPass::KICK, m_Integrator.Kick(m_Integrator.Drifts()) * timestep);
+		} else if (m_Solver == SimulationSolver::RKF45) {
+			// take as many error controlled substeps as it needs to reach the next recorded step
+			double remaining = timestep;
+			bool retry = false;
+			while (remaining > 0.0) {
+				double step = std::min(adaptive_step, remaining);
+				Integrate(IntegratorPass::SAVE, step);
+				for (size_t stage = 0; stage < RKF45_STAGES; stage++) {
+					// a retry starts from the same base, so the first stage recorded by the rejected attempt still holds
+					if (stage == 0 && retry) continue;
+					if (stage > 0) Integrate(IntegratorPass::STAGE, step, stage);
+					ComputeForces();
+					Integrate(IntegratorPass::RECORD, step, stage);
+				}
+				Integrate(IntegratorPass::COMBINE, step);
+				StepError error = m_Scheduler.metadata[0].error;
+				for (size_t j = 1; j < m_Scheduler.metadata.size(); j++) error.Merge(m_Scheduler.metadata[j].error);
+				bool accepted = false;
+				double next = m_Integrator.Adapt(error, timestep / RKF45_MIN_DIVISIONS, &accepted);
+				if (accepted) {
+					remaining = step >= remaining ? 0.0 : remaining - step;
+					accepted_steps++;
 				} else {
-					RESET_METADATA_TREES(m_Scheduler.metadata[j].trees);
-					leaves[j]->m_SizeRef = nullptr;
-					m_Scheduler.metadata[j].trees[0] = leaves[j];
-					m_Scheduler.metadata[j].ignore = ignoreind;
-					m_Scheduler.metadata[j].finished = false;
-					m_Scheduler.metadata[j].stage = WorkerStage::OCTTREE;
-					m_Scheduler.worker_alerts[j]->notify_all();
+					Integrate(IntegratorPass::RESTORE, step);
+					rejected_steps++;
 				}
+				retry = !accepted;
+				// a step clipped to the recorded step says nothing about how large the next one may be
+				if (!accepted || step == adaptive_step) adaptive_step = next;
 			}
-			m_Scheduler.lock.unlock();
-			WAIT_ON_WORKERS();
-
-			// apply quadtree
-			tree.CalculateCenterOfMass();
-			m_Scheduler.lock.lock();
-			for (size_t j = 0; j < m_Scheduler.metadata.size(); j++) {
-				m_Scheduler.metadata[j].finished = false;
-				m_Scheduler.metadata[j].stage = WorkerStage::APPLY;
-				RESET_METADATA_TREES(m_Scheduler.metadata[j].trees);
-				m_Scheduler.metadata[j].trees[0] = &tree;
-				m_Scheduler.worker_alerts[j]->notify_all();
-			}
-			m_Scheduler.lock.unlock();
-			WAIT_ON_WORKERS();
-		} else if (m_Technique == SimulationTechnique::EDGE || m_Technique == SimulationTechnique::PARTICLE) {
-			// launch the update acceleration step
-			LAUNCH_NAIVE_STEP(WorkerStage::FORCEMATRIX);
-			WAIT_ON_WORKERS();
 		} else {
-			FATAL("Unhandled technique");
+			FATAL("Unhandled solver");
 		}
 
-		// launch the update step to apply forces to particles
-		LAUNCH_UPDATE_STEP(WorkerStage::UPDATE);
-		WAIT_ON_WORKERS();
-
-		// recalculate overall bounds
-		m_Scheduler.bounds.Reset();
-		for (size_t j = 0; j < m_NumLocalWorkers; j++) {
-			BoundaryData b = m_Scheduler.metadata[j].bounds;
-			if (b.xmin < m_Scheduler.bounds.xmin) m_Scheduler.bounds.xmin = b.xmin;
-			if (b.ymin < m_Scheduler.bounds.ymin) m_Scheduler.bounds.ymin = b.ymin;
-			if (b.zmin < m_Scheduler.bounds.zmin) m_Scheduler.bounds.zmin = b.zmin;
-			if (b.xmax > m_Scheduler.bounds.xmax) m_Scheduler.bounds.xmax = b.xmax;
-			if (b.ymax > m_Scheduler.bounds.ymax) m_Scheduler.bounds.ymax = b.ymax;
-			if (b.zmax > m_Scheduler.bounds.zmax) m_Scheduler.bounds.zmax = b.zmax;
+		// track how evenly the force walk was spread over the workers
+		if (m_StepInteractions > 0) {
+			double imbalance = (double)m_StepBusiest * (double)m_Scheduler.metadata.size() / (double)m_StepInteractions;
+			imbalance_total += imbalance;
+			imbalance_worst = std::max(imbalance_worst, imbalance);
+			imbalance_steps++;
+			if (imbalance_steps % IMBALANCE_LOG_INTERVAL == 1 || imbalance >= IMBALANCE_LOG_THRESHOLD) {
+				std::stringstream report;
+				report << "step " << (i + 1) << " force imbalance " << std::fixed << std::setprecision(3) << imbalance;
+				m_Scheduler.lock.lock();
+				this->Log(report.str());
+				m_Scheduler.lock.unlock();
+			}
+		}
+
+		// record what the policy asks for, the last step and keyframes always go on record
+		uint64_t step = i + 1;
+		bool keyframe = m_KeyframeInterval > 0 && (step % m_KeyframeInterval == 0 || step == steps);
+		if (step == steps || keyframe || RecordDue(step)) CaptureFrame(step, keyframe);
+
+		// hand the state to the checkpoint writer once the interval is up, skipping a turn while it is still busy
+		if (m_EnableSafeguardCache && step < steps && std::chrono::duration<double>(std::chrono::steady_clock::now() - checkpoint_clock).count() >= m_SafeguardSeconds) {
+			CheckpointHeader header = { 0, 0, m_Origin, 0, step, steps, accepted_steps, rejected_steps, adaptive_step };
+			if (m_CheckpointWriter.Submit(CheckpointPath(), header, m_ParticleStore)) {
+				checkpoint_clock = std::chrono::steady_clock::now();
+				checkpoints++;
+			}
 		}
 
 		// update simulation progress
-		simulation_progress.push_back(std::vector<Particle>(m_ParticleSlice));
 		m_Scheduler.lock.lock();
 		m_Progress = (float)((float)(i + 1) / (float)steps);
 		m_Scheduler.lock.unlock();
 	}
 
 	// kill all subprocesses
-	LAUNCH_NAIVE_STEP(WorkerStage::KILL);
+	LAUNCH_STEP(WorkerStage::KILL);
 	
 	// notify done and finalize simulation record
     m_Scheduler.lock.lock();
+	if (m_DirectSeconds > 0.0) {
+		std::stringstream throughput;
+		throughput << "direct summation averaged " << std::setprecision(3) << (m_DirectInteractions / m_DirectSeconds) << " interactions per second";
+		this->Log(throughput.str());
+	}
+	if (m_Solver == SimulationSolver::RKF45) {
+		std::stringstream substeps;
+		substeps << "rkf45 took " << accepted_steps << " substeps (" << rejected_steps << " rejected)";
+		this->Log(substeps.str());
+	}
+	if (blocks && block_steps > 0) {
+		std::stringstream substeps;
+		substeps << "block timesteps took " << block_steps << " substeps down to level " << block_finest << ", " << std::setprecision(3) << ((double)block_active / (double)block_steps) << " active particles on average";
+		this->Log(substeps.str());
+	}
+	if (imbalance_steps > 0) {
+		std::stringstream imbalance;
+		imbalance << "force imbalance averaged " << std::fixed << std::setprecision(3) << (imbalance_total / (double)imbalance_steps) << ", worst " << imbalance_worst;
+		this->Log(imbalance.str());
+	}
+	if (m_TreeUpdate == SimulationTreeUpdate::REFIT && m_TreeRefits + m_TreeRebuilds > 0)
+		this->Log("refit the octtree " + std::to_string(m_TreeRefits) + " times and rebuilt it " + std::to_string(m_TreeRebuilds) + " times");
+	this->Log("evaluated forces " + std::to_string(m_ForceEvaluations) + " times");
+
+	// a finished run has nothing left to resume
+	m_CheckpointWriter.Close();
+	if (m_EnableSafeguardCache) {
+		if (checkpoints > 0) this->Log("wrote " + std::to_string(checkpoints) + " checkpoints" + (m_CheckpointWriter.Failed() ? ", some of them failed" : ""));
+		std::error_code error;
+		std::filesystem::remove(CheckpointPath(), error);
+	}
+	uint64_t frames = m_TrajectoryWriter.Close();
+	this->Log("recorded " + std::to_string(frames) + " frames over " + std::to_string(steps) + " steps");
+	if (m_TrajectoryWriter.Failed()) this->Log("could not write the whole trajectory, playback stops after " + std::to_string(frames) + " frames");
+	m_Trajectory.Open(m_TrajectoryPath);
 	m_Finished = true;
-	m_SimulationRecord = simulation_progress;
 	m_Scheduler.lock.unlock();
-
-	#undef WAIT_ON_WORKERS
-	#undef LAUNCH_NAIVE_STEP
-	#undef LAUNCH_UPDATE_STEP
-	#undef RESET_METADATA_TREES
 }
 
-void Simulation::LocalJob(size_t index) {
-	#define WAITJOB() { \
-		std::unique_lock<std::mutex> lock(m_Scheduler.lock); \
-		m_Scheduler.worker_alerts[index]->wait(lock, [this, &index] { return !m_Scheduler.metadata[index].finished; }); \
-	}
+#undef LAUNCH_STEP
+#undef SUBMIT_STEP
+#undef SUBMIT_WEIGHTED_STEP
 
+void Simulation::LocalJob(size_t index) {
+	// park until the controller flips the barrier sense, then drain the queue for that stage
+	uint32_t sense = 0;
 	while (true) {
-		WorkerStage stage = m_Scheduler.metadata[index].stage;
-		switch (stage) {
-			case WorkerStage::KILL:
-				return;
-			case WorkerStage::SETUP:
-				break;
-			case WorkerStage::FORCEMATRIX:
-				if (m_Technique == SimulationTechnique::EDGE) {
-					for (size_t i = 0; i < m_Scheduler.metadata[index].edges.size(); i++) {
-						size_t r = m_Scheduler.metadata[index].edges[i].first;
-						size_t c = m_Scheduler.metadata[index].edges[i].second;
-						Particle px = m_ParticleSlice[r];
-						Particle py = m_ParticleSlice[c];
-						float dx = m_UnitSize * (py.Position().x - px.Position().x);
-						float dy = m_UnitSize * (py.Position().y - px.Position().y);
-						float dz = m_UnitSize * (py.Position().z - px.Position().z);
-						float inv_r3 = std::pow((dx*dx) + (dy*dy) + (dz*dz) + (3*3), -1.5);
-						glm::dvec3 pxa = { 0, 0, 0 };
-						glm::dvec3 pya = { 0, 0, 0 };
-						pxa.x = GRAVITY * (dx * inv_r3) * py.Mass();
-						pxa.y = GRAVITY * (dy * inv_r3) * py.Mass();
-						pxa.z = GRAVITY * (dz * inv_r3) * py.Mass();
-						pya.x = -1.0 * pxa.x * px.Mass() / py.Mass();
-						pya.y = -1.0 * pxa.y * px.Mass() / py.Mass();
-						pya.z = -1.0 * pxa.z * px.Mass() / py.Mass();
-						m_ForceMatrix[r][c] = pxa;
-						m_ForceMatrix[c][r] = pya;
+		sense = m_Scheduler.barrier.Await(sense);
+		WorkerStage stage = m_Scheduler.stage;
+		if (stage == WorkerStage::KILL) return;
+		TaskRange task;
+		while (m_Scheduler.tasks.Pop(index, &task)) {
+			switch (stage) {
+				case WorkerStage::SETUP:
+					break;
+				case WorkerStage::DIRECT:
+					if (m_PartialForces) {
+						m_DirectSum.Targets(m_Integrator.Active(), task.begin, task.end);
+					} else if (m_RunTechnique == SimulationTechnique::EDGE) {
+						m_DirectSum.Edges(task.begin, task.end, index);
+					} else if (m_RunTechnique == SimulationTechnique::PARTICLE) {
+						m_DirectSum.Particles(task.begin, task.end);
+					} else {
+						FATAL("Unhandled technique");
 					}
-				} else if (m_Technique == SimulationTechnique::PARTICLE) {
-					for (size_t i = m_Scheduler.metadata[index].particles.index; i < m_Scheduler.metadata[index].particles.index + m_Scheduler.metadata[index].particles.size; i++) {
-						for (size_t j = i + 1; j < m_Particles.size(); j++) {
-							Particle px = m_ParticleSlice[i];
-							Particle py = m_ParticleSlice[j];
-							float dx = m_UnitSize * (py.Position().x - px.Position().x);
-							float dy = m_UnitSize * (py.Position().y - px.Position().y);
-							float dz = m_UnitSize * (py.Position().z - px.Position().z);
-							float inv_r3 = std::pow((dx*dx) + (dy*dy) + (dz*dz) + (3*3), -1.5);
-							glm::dvec3 pxa = { 0, 0, 0 };
-							glm::dvec3 pya = { 0, 0, 0 };
-							pxa.x = GRAVITY * (dx * inv_r3) * py.Mass();
-							pxa.y = GRAVITY * (dy * inv_r3) * py.Mass();
-							pxa.z = GRAVITY * (dz * inv_r3) * py.Mass();
-							pya.x = -1.0 * pxa.x * px.Mass() / py.Mass();
-							pya.y = -1.0 * pxa.y * px.Mass() / py.Mass();
-							pya.z = -1.0 * pxa.z * px.Mass() / py.Mass();
-							m_ForceMatrix[i][j] = pxa;
-							m_ForceMatrix[j][i] = pya;
+					break;
+				case WorkerStage::CAPTURE:
+					m_ParticleStore.Capture(m_CaptureFrame, task.begin, task.end);
+					if (!m_RecordReference.x.empty()) m_ParticleStore.Capture(&m_RecordReference, task.begin, task.end);
+					break;
+				case WorkerStage::DISPLACEMENT:
+					MeasureDisplacement(task.begin, task.end, &m_Scheduler.metadata[index].displacement);
+					break;
+				case WorkerStage::UPDATE:
+					m_Integrator.Run(task.begin, task.end, &m_Scheduler.metadata[index].error);
+					if (m_Integrator.Moves() && m_Periodic) WrapPositions(task.begin, task.end);
+					if (m_Integrator.Moves()) {
+						// exact extrema here, the margin is added once when merging so the result does not depend on which worker ran which chunk
+						ParticleSoA& s = m_ParticleStore;
+						BoundaryData& bounds = m_Scheduler.metadata[index].bounds;
+						for (size_t i = task.begin; i < task.end; i++) {
+							bounds.xmin = std::min(bounds.xmin, s.px[i]);
+							bounds.ymin = std::min(bounds.ymin, s.py[i]);
+							bounds.zmin = std::min(bounds.zmin, s.pz[i]);
+							bounds.xmax = std::max(bounds.xmax, s.px[i]);
+							bounds.ymax = std::max(bounds.ymax, s.py[i]);
+							bounds.zmax = std::max(bounds.zmax, s.pz[i]);
 						}
 					}
-				} else {
-					FATAL("Unhandled technique");
-				}
-				break;
-			case WorkerStage::UPDATE:
-				m_Scheduler.metadata[index].bounds.Reset();
-				for (size_t i = m_Scheduler.metadata[index].particles.index; i < m_Scheduler.metadata[index].particles.index + m_Scheduler.metadata[index].particles.size; i++) {
-					m_ParticleSlice[i].SetVelocity(m_ParticleSlice[i].Velocity() + (0.5 * m_Timestep * m_ParticleSlice[i].Acceleration())/m_UnitSize);
-					m_ParticleSlice[i].SetPosition(m_ParticleSlice[i].Position() + ((double)m_Timestep * m_ParticleSlice[i].Velocity()));
-					if (m_Technique == SimulationTechnique::EDGE || 
-						m_Technique == SimulationTechnique::PARTICLE) {
-						glm::dvec3 accel = { 0.0, 0.0, 0.0 };
-						for (size_t j = 0; j < m_Particles.size(); j++) {
-							accel.x += m_ForceMatrix[i][j].x;
-							accel.y += m_ForceMatrix[i][j].y;
-							accel.z += m_ForceMatrix[i][j].z;
+					break;
+				case WorkerStage::REDUCE:
+					m_DirectSum.Reduce(task.begin, task.end);
+					break;
+				case WorkerStage::OCTTREE:
+					if (m_RunBackend == SimulationTreeBackend::FLAT || m_RunTechnique == SimulationTechnique::FMM) {
+						for (size_t k = task.begin; k < task.end && !m_FlatTree.Overflowed(); k++) {
+							int32_t node = m_Scheduler.nodes[k];
+							if (m_TreeConstruction == SimulationTreeConstruction::MORTON) {
+								if (m_FlatTree.Build(node)) m_FlatTree.CalculateCenterOfMass(node);
+								continue;
+							}
+							for (size_t j = m_Scheduler.ignore; j < m_ParticleStore.Size(); j++) {
+								if (m_FlatTree.Node(node).boundary.Contains(m_ParticleStore.Position(j)) && !m_FlatTree.Insert((int32_t)j, node)) break;
+							}
+							if (!m_FlatTree.Overflowed()) m_FlatTree.CalculateCenterOfMass(node);
 						}
-						m_ParticleSlice[i].SetAcceleration(accel);
+						break;
 					}
-					m_ParticleSlice[i].SetVelocity(m_ParticleSlice[i].Velocity() + (0.5 * m_Timestep * m_ParticleSlice[i].Acceleration())/m_UnitSize);
-					glm::dvec3 pos = m_ParticleSlice[i].Position();
-					if (pos.x < m_Scheduler.metadata[index].bounds.xmin) m_Scheduler.metadata[index].bounds.xmin = pos.x - 0.001;
-					if (pos.y < m_Scheduler.metadata[index].bounds.ymin) m_Scheduler.metadata[index].bounds.ymin = pos.y - 0.001;
-					if (pos.z < m_Scheduler.metadata[index].bounds.zmin) m_Scheduler.metadata[index].bounds.zmin = pos.z - 0.001;
-					if (pos.x > m_Scheduler.metadata[index].bounds.xmax) m_Scheduler.metadata[index].bounds.xmax = pos.x + 0.001;
-					if (pos.y > m_Scheduler.metadata[index].bounds.ymax) m_Scheduler.metadata[index].bounds.ymax = pos.y + 0.001;
-					if (pos.z > m_Scheduler.metadata[index].bounds.zmax) m_Scheduler.metadata[index].bounds.zmax = pos.z + 0.001;
-				}
-				break;
-			case WorkerStage::OCTTREE:
-				for (size_t i = 0; i < 8; i++) {
-					Octtree* tree = m_Scheduler.metadata[index].trees[i];
-					if (tree != nullptr) {
-						for (size_t j = m_Scheduler.metadata[index].ignore; j < m_Particles.size(); j++) {
+					for (size_t k = task.begin; k < task.end; k++) {
+						Octtree* tree = m_Scheduler.trees[k];
+						for (size_t j = m_Scheduler.ignore; j < m_ParticleSlice.size(); j++) {
 							if (tree->m_Boundary.Contains(&m_ParticleSlice[j])) tree->Insert(&m_ParticleSlice[j]);
 						}
-					} else {
+						tree->CalculateCenterOfMass();
+					}
+					break;
+				case WorkerStage::MORTON:
+					m_FlatTree.ComputeKeys(task.begin, task.end);
+					break;
+				case WorkerStage::RADIXCOUNT:
+					m_FlatTree.CountDigits(task.begin, task.end, task.id);
+					break;
+				case WorkerStage::RADIXSCATTER:
+					m_FlatTree.ScatterDigits(task.begin, task.end, task.id);
+					break;
+				case WorkerStage::REFIT:
+					m_FlatTree.Evict(task.begin, task.end, &m_Scheduler.metadata[index].escaped);
+					break;
+				case WorkerStage::MOMENTS:
+					for (size_t k = task.begin; k < task.end; k++) m_FlatTree.CalculateCenterOfMass(m_Scheduler.nodes[k]);
+					break;
+				case WorkerStage::APPLY:
+					if (m_RunBackend == SimulationTreeBackend::FLAT) {
+						for (size_t g = task.begin; g < task.end; g++) {
+							GroupScratch& scratch = m_Scheduler.metadata[index].scratch;
+							size_t interactions = m_FlatTree.GroupCalculateForce(m_FlatTree.Groups()[m_Targets[g]], m_UnitSize, scratch, m_Multipole == SimulationMultipole::QUADRUPOLE, Forces());
+							for (uint32_t p : scratch.targets) m_Interactions[p] = interactions / scratch.targets.size();
+							m_Scheduler.metadata[index].interactions += interactions;
+						}
 						break;
 					}
-				}
-				break;
-			case WorkerStage::APPLY:
-				for (size_t i = m_Scheduler.metadata[index].particles.index; i < m_Scheduler.metadata[index].particles.index + m_Scheduler.metadata[index].particles.size; i++) {
-					m_ParticleSlice[i].SetAcceleration({0.0, 0.0, 0.0});
-					m_Scheduler.metadata[index].trees[0]->SerialCalculateForce(m_ParticleSlice[i], m_UnitSize);
-				}
-				break;
-			default:
-				FATAL("Unknown worker stage");
-				break;
+					for (size_t k = task.begin; k < task.end; k++) {
+						uint32_t i = m_Targets[k];
+						double reference = glm::length(m_ParticleStore.Acceleration(i));
+						m_ParticleSlice[i].SetAcceleration({0.0, 0.0, 0.0});
+						m_Interactions[i] = m_Scheduler.root->SerialCalculateForce(m_ParticleSlice[i], m_UnitSize, Forces(), reference);
+						m_Scheduler.metadata[index].interactions += m_Interactions[i];
+					}
+					break;
+				case WorkerStage::FMMUPWARD:
+					for (size_t k = task.begin; k < task.end; k++)
+						m_FastMultipole.Upward(m_FastMultipole.Tasks()[k], m_Scheduler.metadata[index].expansion);
+					break;
+				case WorkerStage::FMMINTERACT:
+					for (size_t k = task.begin; k < task.end; k++)
+						m_FastMultipole.Interact(m_FastMultipole.Tasks()[k], 0, m_Scheduler.metadata[index].expansion);
+					break;
+				case WorkerStage::FMMDOWNWARD:
+					for (size_t k = task.begin; k < task.end; k++)
+						m_FastMultipole.Downward(m_FastMultipole.Tasks()[k], m_Scheduler.metadata[index].expansion, m_Scheduler.metadata[index].scratch);
+					break;
+				case WorkerStage::PMDEPOSIT:
+					m_ParticleMesh.Deposit(task.begin, task.end, index);
+					break;
+				case WorkerStage::PMGATHER:
+					m_ParticleMesh.Gather(task.begin, task.end);
+					break;
+				case WorkerStage::PMTRANSFORM:
+					m_ParticleMesh.Transform(task.begin, task.end, index);
+					break;
+				case WorkerStage::PMCONVOLVE:
+					m_ParticleMesh.Convolve(task.begin, task.end);
+					break;
+				case WorkerStage::PMGRADIENT:
+					m_ParticleMesh.Differentiate(task.begin, task.end);
+					break;
+				case WorkerStage::PMINTERPOLATE:
+					m_ParticleMesh.Interpolate(m_PartialForces ? &m_MeshTargets : nullptr, task.begin, task.end, m_RunTechnique == SimulationTechnique::TREEPM);
+					break;
+				default:
+					FATAL("Unknown worker stage");
+					break;
+			}
 		}
-		// lock, update, and wait to continue
-		m_Scheduler.lock.lock();
-		m_Scheduler.metadata[index].finished = true;
-		m_Scheduler.controller_alert.notify_all();
-		m_Scheduler.lock.unlock();
-		WAITJOB();
+		m_Scheduler.barrier.Arrive();
 	}
-
-	#undef WAITJOB
 }
 
 bool Simulation::Connect(std::string& ipaddr, std::string& port, uint32_t size, SimulationDetails* details) {
@@ -424,6 +926,17 @@ void Simulation::StartRemote() {
 	// start simulation
 	this->Log("starting simulation...");
 
+	// remote runs take the technique as set, their workers have nothing to fall back to
+	m_RunTechnique = m_Technique;
+	m_RunBackend = m_TreeBackend;
+
+	// remote workers walk pointer octtrees, which know nothing of periodic images
+	m_Periodic = false;
+	if (m_Boundary == SimulationBoundary::PERIODIC) this->Log("remote simulations do not support periodic boundaries, running with open boundaries");
+
+	// the host only ever holds its own slice of the particles, so there is no full state to checkpoint or resume
+	if (m_EnableSafeguardCache) this->Log("remote simulations do not support the safeguard cache, running without checkpoints");
+
 	// reset and calculate initial bounds
 	m_Scheduler.bounds.Reset();
 	for (size_t i = 0; i < m_Particles.size(); i++) {
@@ -446,13 +959,54 @@ void Simulation::StartLocal() {
 	// clear any lingering subprocesses
 	m_SubProcesses.clear();
 
-	// prep force matrix
-	m_ForceMatrix.resize(m_Particles.size(), std::vector<glm::dvec3>(m_Particles.size(), {0, 0, 0}));
+	// build the run time particle store the workers step on
+	m_ParticleStore.Load(m_Particles);
+
+	// periodic runs need a box to wrap into and a force walk that knows about the images, falling back for this
+	// run only so the scene keeps the technique it was set up with
+	m_RunTechnique = m_Technique;
+	m_RunBackend = m_TreeBackend;
+	m_Periodic = m_Boundary == SimulationBoundary::PERIODIC;
+	if (m_Periodic && (m_Bounds.x <= 0 || m_Bounds.y <= 0 || m_Bounds.z <= 0)) {
+		this->Log("periodic boundaries need positive bounds, running with open boundaries");
+		m_Periodic = false;
+	}
+	if (m_Periodic && (m_RunTechnique == SimulationTechnique::FMM || (m_RunTechnique == SimulationTechnique::BARNESHUT && m_RunBackend == SimulationTreeBackend::POINTER))) {
+		this->Log("periodic boundaries need the flat octtree or direct summation, running flat barnes-hut");
+		m_RunTechnique = SimulationTechnique::BARNESHUT;
+		m_RunBackend = SimulationTreeBackend::FLAT;
+	}
+
+	// the mesh takes its resolution and split from the first grid
+	if (m_RunTechnique == SimulationTechnique::PARTICLEMESH || m_RunTechnique == SimulationTechnique::TREEPM) {
+		if (m_RunTechnique == SimulationTechnique::TREEPM && m_RunBackend == SimulationTreeBackend::POINTER) {
+			this->Log("treepm needs the flat octtree, running with it");
+			m_RunBackend = SimulationTreeBackend::FLAT;
+		}
+		if (m_Grids.empty()) this->Log("no grid to take the mesh from, using a " + std::to_string(GRID_RESOLUTION) + " cell mesh");
+		else if (m_Grids.size() > 1) this->Log("using the first of " + std::to_string(m_Grids.size()) + " grids for the mesh");
+	}
+
+	// a safeguarded run picks up from the checkpoint an interrupted run of the same scene left behind
+	m_Origin = Fingerprint();
+	m_Resume = {};
+	CheckpointReader checkpoint;
+	if (m_EnableSafeguardCache && FindCheckpoint(checkpoint)) {
+		checkpoint.Restore(m_ParticleStore);
+		m_Resume = checkpoint.Header();
+		this->Log("resuming from the checkpoint at step " + std::to_string(m_Resume.step) + " of " + std::to_string(m_Resume.steps));
+	}
+	if (m_Periodic) WrapPositions(0, m_ParticleStore.Size());
+
+	// local runs play back from a trajectory named like the checkpoint, so a resumed run appends to the one it left
+	std::stringstream trajectory;
+	trajectory << TRAJECTORY_DIRECTORY << "/trajectory_" << std::hex << std::setw(16) << std::setfill('0') << m_Origin << ".traj";
+	m_TrajectoryPath = trajectory.str();
 
 	// reset and calculate initial bounds
 	m_Scheduler.bounds.Reset();
-	for (size_t i = 0; i < m_Particles.size(); i++) {
-		glm::dvec3 pos = m_Particles[i]->Position();
+	for (size_t i = 0; i < m_ParticleStore.Size(); i++) {
+		glm::dvec3 pos = m_ParticleStore.Position(i);
 		if (pos.x < m_Scheduler.bounds.xmin) m_Scheduler.bounds.xmin = pos.x - 0.001;
 		if (pos.y < m_Scheduler.bounds.ymin) m_Scheduler.bounds.ymin = pos.y - 0.001;
 		if (pos.z < m_Scheduler.bounds.zmin) m_Scheduler.bounds.zmin = pos.z - 0.001;
@@ -461,110 +1015,26 @@ void Simulation::StartLocal() {
 		if (pos.z > m_Scheduler.bounds.zmax) m_Scheduler.bounds.zmax = pos.z + 0.001;
 	}
 
-	if (m_Technique == SimulationTechnique::PARTICLE || m_Technique == SimulationTechnique::BARNESHUT) {
-		// optimize the number of workers for particles
-		if (m_NumLocalWorkers > m_Particles.size()) {
-			m_NumLocalWorkers = m_Particles.size();
-			this->Log("more workers than possible jobs detected. truncating extra workers...");
-		}
-		bool uneven = m_Particles.size() % m_NumLocalWorkers != 0;
-		size_t jobsize = uneven ? (m_Particles.size() / m_NumLocalWorkers) + 1 : m_Particles.size() / m_NumLocalWorkers;
-		size_t optimal_workers = m_Particles.size() % jobsize != 0 ? (m_Particles.size() / jobsize) + 1 : m_Particles.size() / jobsize;
-		if (optimal_workers != m_NumLocalWorkers) {
-			this->Log("more workers than possible jobs needed. truncating additional workers...");
-			m_NumLocalWorkers = optimal_workers;
-		}
-
-		// set up scheduler
-		m_Scheduler.metadata.clear();
-		m_Scheduler.worker_alerts.clear();
-		for (uint32_t i = 0; i < m_NumLocalWorkers; i++) {
-			ParticleJobData data = { i * jobsize, jobsize };
-			if (i == m_NumLocalWorkers - 1 && uneven) data.size = m_Particles.size() % jobsize;
-			m_Scheduler.metadata.push_back({
-				WorkerStage::SETUP,
-				true,
-				false,
-				data,
-				{},
-				{},
-				0
-			});
-			m_Scheduler.worker_alerts.push_back(CreateScope<std::condition_variable>());
-		}
-	} else {
-		// calculate number of edges and optimal jobsize
-		size_t numedges = ((m_Particles.size() * m_Particles.size()) - m_Particles.size()) / 2;
-		if (m_NumLocalWorkers > numedges) {
-			m_NumLocalWorkers = numedges;
-			this->Log("more workers than possible jobs detected. truncating extra workers...");
-		}
-		bool uneven = numedges % m_NumLocalWorkers != 0;
-		size_t jobsize = uneven ? (numedges / m_NumLocalWorkers) + 1 : numedges / m_NumLocalWorkers;
-		size_t optimal_workers = numedges % jobsize != 0 ? (numedges / jobsize) + 1 : numedges / jobsize;
-		if (optimal_workers != m_NumLocalWorkers) {
-			this->Log("more workers than possible jobs needed. truncating additional workers...");
-			m_NumLocalWorkers = optimal_workers;
-		}
-		size_t second_jobsize = m_Particles.size() % optimal_workers != 0 ? (m_Particles.size() / optimal_workers) + 1 : m_Particles.size() / optimal_workers;
-	
-		// set up scheduler
-		m_Scheduler.metadata.clear();
-		m_Scheduler.worker_alerts.clear();
-		m_Scheduler.metadata.push_back({
-			WorkerStage::SETUP,
-			true,
-			false,
-			{ 0, 0 },
-			{},
-			{},
-			0
-		});
-		m_Scheduler.worker_alerts.push_back(CreateScope<std::condition_variable>());
-		size_t p_ind = 0;
-		for (size_t r = 0; r < m_Particles.size(); r++) {
-			for (size_t c = 0; c < m_Particles.size(); c++) {
-				if (c <= r) c = r + 1;
-				if (c >= m_Particles.size()) continue;
-				if (m_Scheduler.metadata[m_Scheduler.metadata.size() - 1].edges.size() >= jobsize) {
-					size_t range = second_jobsize;
-					size_t ind = p_ind;
-					if (p_ind + range > m_Particles.size()) range = m_Particles.size() - p_ind;
-					if (p_ind >= m_Particles.size()) {
-						ind = 0;
-						range = 0;
-					}
-					m_Scheduler.metadata[m_Scheduler.metadata.size() - 1].particles = { ind, range };
-					p_ind += range;
-					m_Scheduler.metadata.push_back({
-						WorkerStage::SETUP,
-						true,
-						false,
-						{ 0, 0 },
-						{},
-						{},
-						0
-					});
-					m_Scheduler.worker_alerts.push_back(CreateScope<std::condition_variable>());
-				}
-				m_Scheduler.metadata[m_Scheduler.metadata.size() - 1].edges.push_back(std::pair<size_t, size_t>(r, c));
-			}
-		}
-		if (m_Scheduler.metadata[m_Scheduler.metadata.size() - 1].edges.size() > 0) {
-			size_t range = second_jobsize;
-			size_t ind = p_ind;
-			if (p_ind + range > m_Particles.size()) range = m_Particles.size() - p_ind;
-			if (p_ind >= m_Particles.size()) {
-				ind = 0;
-				range = 0;
-			}
-			m_Scheduler.metadata[m_Scheduler.metadata.size() - 1].particles = { ind, range };
-		}
+	// optimize the number of workers for particles
+	if (m_NumLocalWorkers > m_Particles.size()) {
+		m_NumLocalWorkers = m_Particles.size();
+		this->Log("more workers than possible jobs detected. truncating extra workers...");
+	}
 
-		// verify creation
-		if (m_NumLocalWorkers != m_Scheduler.metadata.size()) FATAL("Invalid job creation detected");
+	// set up scheduler
+	m_Scheduler.metadata.clear();
+	m_Scheduler.tasks.Resize(m_NumLocalWorkers);
+	m_Scheduler.barrier.Resize(m_NumLocalWorkers);
+	m_Scheduler.stage = WorkerStage::SETUP;
+	for (uint32_t i = 0; i < m_NumLocalWorkers; i++) {
+		m_Scheduler.metadata.push_back({ true });
 	}
 
+	if (m_RunTechnique == SimulationTechnique::PARTICLE || m_RunTechnique == SimulationTechnique::EDGE)
+		this->Log(std::string("using the ") + ForceKernel::InstructionSet() + (m_Precision == SimulationPrecision::MIXED ? " mixed precision" : " double precision") + " force kernel");
+	else if (m_RunTechnique != SimulationTechnique::PARTICLEMESH && (m_RunTechnique == SimulationTechnique::FMM || m_RunBackend == SimulationTreeBackend::FLAT))
+		this->Log(std::string("using the ") + ForceKernel::InstructionSet() + " force kernel");
+
 	// create subprocesses
 	for (uint32_t i = 0; i < m_NumLocalWorkers; i++) {
 		m_SubProcesses.push_back(std::thread(&Simulation::LocalJob, this, i));
@@ -581,7 +1051,6 @@ void Simulation::StartLocal() {
 
 void Simulation::Pause() {
     this->Log("pausing simulation...");
-	m_Scheduler.controller_alert.notify_all();
     this->Log("paused simulation");
     m_Paused = true; 
 }
@@ -604,6 +1073,8 @@ void Simulation::Prime() {
 	m_Started = false;
 	m_Paused = false;
 	m_Finished = false;
+	DropTrajectory();
+	m_SimulationRecord.clear();
 }
 
 void Simulation::Finish() {
@@ -1,18 +1,34 @@
 #pragma once
 #include "Simulation/Grid.h"
 #include "Simulation/Particle.h"
+#include "Simulation/ParticleSoA.h"
 #include "Simulation/Sink.h"
 #include "Simulation/Source.h"
 #include "Simulation/Packets.h"
 #include "Simulation/Octtree.h"
+#include "Simulation/FlatOcttree.h"
+#include "Simulation/Multipole.h"
+#include "Simulation/DirectSum.h"
+#include "Simulation/Ewald.h"
+#include "Simulation/ParticleMesh.h"
+#include "Simulation/Trajectory.h"
+#include "Simulation/Checkpoint.h"
+#include "Simulation/TaskQueue.h"
+#include "Simulation/Barrier.h"
+#include "Simulation/Integrator.h"
 #include "Core/Safety.h"
 #include <glm/glm.hpp>
 #include <vector>
 #include <mutex>
 #include <thread>
 #include <limits>
+#include <chrono>
 #include <condition_variable>
 
+// the per-step force imbalance goes on the log every so many steps, or on any step that is this far off balance
+#define IMBALANCE_LOG_INTERVAL 64
+#define IMBALANCE_LOG_THRESHOLD 1.5
+
 enum class SimulationLengthUnit {
 	TICKS = 0,
 	MICROSECONDS = 1,
@@ -24,28 +40,82 @@ enum class SimulationSolver {
 	RKF45 = 0,
 	EULER = 1,
 	LEAPFROG = 2,
+	FORESTRUTH = 3,
+	YOSHIDA4 = 4,
+	YOSHIDA6 = 5,
 };
 
 enum class SimulationTechnique {
 	BARNESHUT = 0,
 	PARTICLE = 1,
 	EDGE = 2,
+	FMM = 3,
+	PARTICLEMESH = 4,
+	TREEPM = 5,
+};
+
+enum class SimulationTreeBackend {
+	FLAT = 0,
+	POINTER = 1,
+};
+
+enum class SimulationTreeConstruction {
+	MORTON = 0,
+	INSERTION = 1,
+};
+
+enum class SimulationTreeUpdate {
+	REBUILD = 0,
+	REFIT = 1,
+};
+
+enum class SimulationMultipole {
+	QUADRUPOLE = 0,
+	MONOPOLE = 1,
+};
+
+enum class SimulationBoundary {
+	OPEN = 0,
+	PERIODIC = 1,
+};
+
+enum class SimulationPrecision {
+	DOUBLE = 0,
+	MIXED = 1,
+};
+
+enum class SimulationRecordPolicy {
+	STEPS = 0,
+	WALLCLOCK = 1,
+	DISPLACEMENT = 2,
 };
 
 enum class WorkerStage {
 	SETUP,
 	UPDATE,
-	FORCEMATRIX,
+	CAPTURE,
+	DISPLACEMENT,
+	DIRECT,
+	REDUCE,
 	OCTTREE,
+	MORTON,
+	RADIXCOUNT,
+	RADIXSCATTER,
+	REFIT,
+	MOMENTS,
 	APPLY,
+	FMMUPWARD,
+	FMMINTERACT,
+	FMMDOWNWARD,
+	PMDEPOSIT,
+	PMGATHER,
+	PMTRANSFORM,
+	PMCONVOLVE,
+	PMGRADIENT,
+	PMINTERPOLATE,
 	KILL
 };
 
-struct ParticleJobData {
-	size_t index;
-	size_t size;
-};
-
 struct BoundaryData {
 	double xmin;
 	double xmax;
@@ -64,22 +134,27 @@ struct BoundaryData {
 };
 
 struct WorkerMetadata {
-	WorkerStage stage;
 	bool local;
-	bool finished;
-	ParticleJobData particles;
-	std::vector<std::pair<size_t, size_t>> edges;
-	Octtree* trees[8];
-	size_t ignore;
 	BoundaryData bounds;
+	uint64_t interactions;
+	StepError error;
+	double displacement;
+	std::vector<uint32_t> escaped;
+	GroupScratch scratch;
+	MultipoleScratch expansion;
 };
 
 struct WorkerScheduler {
-	std::vector<Scope<std::condition_variable>> worker_alerts;
-	std::condition_variable controller_alert;
+	PhaseBarrier barrier;
+	WorkerStage stage;
 	std::vector<WorkerMetadata> metadata;
 	std::mutex lock;
 	BoundaryData bounds;
+	TaskQueue tasks;
+	std::vector<int32_t> nodes;
+	std::vector<Octtree*> trees;
+	Octtree* root;
+	size_t ignore;
 };
 
 struct ClientMetadata {
@@ -97,6 +172,8 @@ struct ServerMetadata {
 class Network;
 
 class Simulation {
+public:
+	~Simulation() { DropTrajectory(); }
 public:
     std::vector<Ref<Source>>& Sources() { return m_Sources; }
     std::vector<Ref<Sink>>& Sinks() { return m_Sinks; }
@@ -111,14 +188,58 @@ public:
 	void SetLength(uint64_t length) { m_SimulationLength = length; }
 	bool SafeguardCacheEnabled() { return m_EnableSafeguardCache; }
 	void SetSafeguardCache(bool enabled) { m_EnableSafeguardCache = enabled; }
+	double SafeguardSeconds() { return m_SafeguardSeconds; }
+	void SetSafeguardSeconds(double seconds) { m_SafeguardSeconds = seconds; }
 	bool SimulationRecordEnabled() { return m_EnableSimulationRecord; }
 	void SetSimulationRecord(bool enabled) { m_EnableSimulationRecord = enabled; }
+	bool RecordVelocities() { return m_RecordVelocities; }
+	void SetRecordVelocities(bool enabled) { m_RecordVelocities = enabled; }
+	double RecordTolerance() { return m_RecordTolerance; }
+	void SetRecordTolerance(double tolerance) { m_RecordTolerance = tolerance; }
+	SimulationRecordPolicy RecordPolicy() { return m_RecordPolicy; }
+	void SetRecordPolicy(SimulationRecordPolicy policy) { m_RecordPolicy = policy; }
+	uint64_t RecordInterval() { return m_RecordInterval; }
+	void SetRecordInterval(uint64_t interval) { m_RecordInterval = interval; }
+	double RecordSeconds() { return m_RecordSeconds; }
+	void SetRecordSeconds(double seconds) { m_RecordSeconds = seconds; }
+	double RecordDisplacement() { return m_RecordDisplacement; }
+	void SetRecordDisplacement(double displacement) { m_RecordDisplacement = displacement; }
+	uint64_t KeyframeInterval() { return m_KeyframeInterval; }
+	void SetKeyframeInterval(uint64_t interval) { m_KeyframeInterval = interval; }
 	SimulationSolver Solver() { return m_Solver; }
 	void SetSolver(SimulationSolver solver) { m_Solver = solver; }
+	double SolverTolerance() { return m_SolverTolerance; }
+	void SetSolverTolerance(double tolerance) { m_SolverTolerance = tolerance; }
 	SimulationTechnique Technique() { return m_Technique; }
 	void SetTechnique(SimulationTechnique technique) { m_Technique = technique; }
-	glm::dvec2 Bounds() { return m_Bounds; }
-	void SetBounds(glm::vec2 bounds) { m_Bounds = bounds; } 
+	SimulationTreeBackend TreeBackend() { return m_TreeBackend; }
+	void SetTreeBackend(SimulationTreeBackend backend) { m_TreeBackend = backend; }
+	SimulationTreeConstruction TreeConstruction() { return m_TreeConstruction; }
+	void SetTreeConstruction(SimulationTreeConstruction construction) { m_TreeConstruction = construction; }
+	SimulationTreeUpdate TreeUpdate() { return m_TreeUpdate; }
+	void SetTreeUpdate(SimulationTreeUpdate update) { m_TreeUpdate = update; }
+	uint32_t LeafSize() { return m_LeafSize; }
+	void SetLeafSize(uint32_t size) { m_LeafSize = size; }
+	OpeningCriterion Opening() { return m_Opening; }
+	void SetOpening(OpeningCriterion opening) { m_Opening = opening; }
+	double Theta() { return m_Theta; }
+	void SetTheta(double theta) { m_Theta = theta > MIN_THETA ? theta : MIN_THETA; }
+	double Softening() { return m_Softening; }
+	void SetSoftening(double softening) { m_Softening = softening > MIN_SOFTENING ? softening : MIN_SOFTENING; }
+	ForceParameters Forces() {
+		bool mesh = m_RunTechnique == SimulationTechnique::TREEPM;
+		return { m_Opening, m_Theta, m_Softening, m_Periodic ? m_Bounds * m_UnitSize : glm::dvec3(0.0), m_Periodic && !mesh ? &m_Ewald : nullptr, mesh ? m_ParticleMesh.Split() : 0.0 };
+	}
+	SimulationMultipole Multipole() { return m_Multipole; }
+	void SetMultipole(SimulationMultipole multipole) { m_Multipole = multipole; }
+	uint32_t ExpansionOrder() { return m_ExpansionOrder; }
+	void SetExpansionOrder(uint32_t order) { m_ExpansionOrder = order; }
+	SimulationPrecision Precision() { return m_Precision; }
+	void SetPrecision(SimulationPrecision precision) { m_Precision = precision; }
+	SimulationBoundary Boundary() { return m_Boundary; }
+	void SetBoundary(SimulationBoundary boundary) { m_Boundary = boundary; }
+	glm::dvec3 Bounds() { return m_Bounds; }
+	void SetBounds(glm::dvec3 bounds) { m_Bounds = bounds; }
 	uint64_t Timestep() { return m_Timestep; }
 	void SetTimestep(uint64_t ts) { m_Timestep = ts; }
 	bool DynamicTimestep() { return m_DynamicTimestep; }
@@ -146,11 +267,24 @@ public:
 	void Checkup();
 	void Prime();
 	std::vector<std::vector<Particle>>& SimulationRecord() { return m_SimulationRecord; }
+	TrajectoryReader& Trajectory() { return m_Trajectory; }
+	bool RestoreKeyframe(uint64_t frame);
 public:
 	WorkerScheduler* SchedulerReference() { return &m_Scheduler; }
 public:
 	void SimulateLocal();
 	void LocalJob(size_t index);
+private:
+	void ComputeForces(bool partial = false);
+	void Integrate(IntegratorPass pass, double step, size_t stage = 0);
+	void WrapPositions(size_t begin, size_t end);
+	void CaptureFrame(uint64_t step, bool keyframe);
+	bool RecordDue(uint64_t step);
+	void MeasureDisplacement(size_t begin, size_t end, double* farthest);
+	void DropTrajectory();
+	uint64_t Fingerprint();
+	std::string CheckpointPath();
+	bool FindCheckpoint(CheckpointReader &checkpoint);
 public:
 	bool Connect(std::string& ipaddr, std::string& port, uint32_t size, SimulationDetails* details);
 	bool Verify();
@@ -171,6 +305,15 @@ private:
 	std::vector<std::string> m_Logs;
 private:
 	std::vector<std::vector<Particle>> m_SimulationRecord;
+	TrajectoryWriter m_TrajectoryWriter;
+	ParticleFrame* m_CaptureFrame = nullptr;
+	ParticleFrame m_RecordReference;
+	std::chrono::steady_clock::time_point m_RecordClock;
+	TrajectoryReader m_Trajectory;
+	std::string m_TrajectoryPath = "";
+	CheckpointWriter m_CheckpointWriter;
+	CheckpointHeader m_Resume = {};
+	uint64_t m_Origin = 0;
 private:
 	size_t m_ClientID = 0;
 	std::thread m_ServerProcess;
@@ -181,7 +324,31 @@ private:
 	Ref<Network> m_Network;
 private:
 	WorkerScheduler m_Scheduler;
-	std::vector<std::vector<glm::dvec3>> m_ForceMatrix;
+	DirectSum m_DirectSum;
+	FlatOcttree m_FlatTree;
+	FastMultipole m_FastMultipole;
+	EwaldTable m_Ewald;
+	ParticleMesh m_ParticleMesh;
+	std::vector<uint32_t> m_MeshTargets;
+	bool m_Periodic = false;
+	// the technique and backend a run actually uses, which may fall back from the scene settings
+	SimulationTechnique m_RunTechnique = SimulationTechnique::BARNESHUT;
+	SimulationTreeBackend m_RunBackend = SimulationTreeBackend::FLAT;
+	Integrator m_Integrator;
+	uint64_t m_ForceEvaluations = 0;
+	double m_DirectSeconds = 0.0;
+	double m_DirectInteractions = 0.0;
+	uint64_t m_StepInteractions = 0;
+	uint64_t m_StepBusiest = 0;
+	std::vector<uint64_t> m_Interactions;
+	std::vector<uint64_t> m_Costs;
+	std::vector<uint32_t> m_Targets;
+	std::vector<uint32_t> m_Escaped;
+	uint64_t m_TreeRefits = 0;
+	uint64_t m_TreeRebuilds = 0;
+	bool m_PartialForces = false;
+	std::vector<uint32_t> m_GroupParticles;
+	ParticleSoA m_ParticleStore;
 	std::vector<Particle> m_ParticleSlice;
 	std::vector<std::thread> m_SubProcesses;
 	std::thread m_MainProcess;
@@ -193,8 +360,17 @@ private:
 	SimulationLengthUnit m_LengthUnit = SimulationLengthUnit::TICKS;
 	uint64_t m_SimulationLength = 0;
 	bool m_EnableSafeguardCache = false;
+	double m_SafeguardSeconds = 300.0;
 	bool m_EnableSimulationRecord = false;
-	glm::dvec2 m_Bounds = { 0, 0 };
+	bool m_RecordVelocities = false;
+	double m_RecordTolerance = 0.0;
+	SimulationRecordPolicy m_RecordPolicy = SimulationRecordPolicy::STEPS;
+	uint64_t m_RecordInterval = 1;
+	double m_RecordSeconds = 1.0;
+	double m_RecordDisplacement = 1.0;
+	uint64_t m_KeyframeInterval = 0;
+	SimulationBoundary m_Boundary = SimulationBoundary::OPEN;
+	glm::dvec3 m_Bounds = { 0, 0, 0 };
 	bool m_DynamicTimestep = false;
 	uint64_t m_Timestep = 0;
 	uint32_t m_NumLocalWorkers = 0;
@@ -202,5 +378,16 @@ private:
 	uint64_t m_TimeTrack = 0;
 	double m_UnitSize = 1.0;
 	SimulationSolver m_Solver = SimulationSolver::RKF45;
+	double m_SolverTolerance = 0.000001;
 	SimulationTechnique m_Technique = SimulationTechnique::BARNESHUT;
+	SimulationTreeBackend m_TreeBackend = SimulationTreeBackend::FLAT;
+	SimulationTreeConstruction m_TreeConstruction = SimulationTreeConstruction::MORTON;
+	SimulationTreeUpdate m_TreeUpdate = SimulationTreeUpdate::REBUILD;
+	uint32_t m_LeafSize = 8;
+	OpeningCriterion m_Opening = OpeningCriterion::GEOMETRIC;
+	double m_Theta = 0.5;
+	double m_Softening = 3.0;
+	SimulationMultipole m_Multipole = SimulationMultipole::QUADRUPOLE;
+	uint32_t m_ExpansionOrder = 4;
+	SimulationPrecision m_Precision = SimulationPrecision::DOUBLE;
 };
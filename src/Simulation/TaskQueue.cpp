@@ -0,0 +1,71 @@
+#include "TaskQueue.h"
+#include <algorithm>
+
+void TaskQueue::Resize(size_t workers) {
+    m_Deques.clear();
+    for (size_t i = 0; i < workers; i++) m_Deques.push_back(CreateScope<TaskDeque>());
+}
+
+size_t TaskQueue::Submit(size_t count, size_t chunks) {
+    // split [0, count) into near equal chunks
+    chunks = std::min(chunks, count);
+    m_Ranges.clear();
+    for (size_t c = 0; c < chunks; c++)
+        m_Ranges.push_back({ c, (c * count) / chunks, ((c + 1) * count) / chunks });
+    return Deal(m_Ranges);
+}
+
+size_t TaskQueue::SubmitWeighted(const std::vector<uint64_t> &costs, size_t chunks) {
+    // split [0, costs.size()) where the running cost crosses each multiple of total / chunks
+    chunks = std::min(chunks, costs.size());
+    m_Ranges.clear();
+    if (chunks == 0) return 0;
+    uint64_t total = 0;
+    for (uint64_t cost : costs) total += cost;
+    uint64_t running = 0;
+    size_t begin = 0;
+    for (size_t i = 0; i < costs.size(); i++) {
+        running += costs[i];
+        if (m_Ranges.size() + 1 < chunks && running * chunks >= total * (m_Ranges.size() + 1)) {
+            m_Ranges.push_back({ m_Ranges.size(), begin, i + 1 });
+            begin = i + 1;
+        }
+    }
+    if (begin < costs.size()) m_Ranges.push_back({ m_Ranges.size(), begin, costs.size() });
+    return Deal(m_Ranges);
+}
+
+size_t TaskQueue::Deal(const std::vector<TaskRange> &ranges) {
+    // deal the chunks out in contiguous runs so each worker starts on neighbouring data
+    size_t workers = m_Deques.size();
+    for (size_t c = 0; c < ranges.size(); c++) {
+        TaskDeque& deque = *m_Deques[(c * workers) / ranges.size()];
+        std::lock_guard<std::mutex> guard(deque.lock);
+        deque.tasks.push_back(ranges[c]);
+    }
+    return ranges.size();
+}
+
+bool TaskQueue::Pop(size_t worker, TaskRange* task) {
+    // drain our own deque from the front, then steal from the back of the others
+    size_t workers = m_Deques.size();
+    {
+        TaskDeque& own = *m_Deques[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            *task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (size_t k = 1; k < workers; k++) {
+        TaskDeque& victim = *m_Deques[(worker + k) % workers];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            *task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
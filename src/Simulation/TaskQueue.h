@@ -0,0 +1,34 @@
+#pragma once
+#include "Core/Safety.h"
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#define TASK_CHUNKS 8
+
+struct TaskRange {
+    size_t id;
+    size_t begin;
+    size_t end;
+};
+
+struct TaskDeque {
+    std::mutex lock;
+    std::deque<TaskRange> tasks;
+};
+
+class TaskQueue {
+public:
+    void Resize(size_t workers);
+    size_t Workers() { return m_Deques.size(); }
+public:
+    size_t Submit(size_t count, size_t chunks);
+    size_t SubmitWeighted(const std::vector<uint64_t> &costs, size_t chunks);
+    bool Pop(size_t worker, TaskRange* task);
+private:
+    size_t Deal(const std::vector<TaskRange> &ranges);
+private:
+    std::vector<TaskRange> m_Ranges;
+    std::vector<Scope<TaskDeque>> m_Deques;
+};
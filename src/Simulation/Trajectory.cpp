@@ -0,0 +1,475 @@
+#include "Trajectory.h"
+#include "Core/Log.h"
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TRAJECTORY_MAGIC 0x4a415254u
+
+static uint32_t TrailingOnes(uint64_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    return _BitScanForward64(&index, ~bits) ? (uint32_t)index : 64;
+#else
+    return ~bits == 0 ? 64 : (uint32_t)__builtin_ctzll(~bits);
+#endif
+}
+
+// least significant bit first, so a run of ones can be counted straight off the bottom of the buffer
+struct BitWriter {
+    std::vector<uint8_t>* bytes;
+    uint64_t buffer = 0;
+    uint32_t count = 0;
+    void Put(uint64_t value, uint32_t bits) {
+        // at most 32 bits at a time so the buffer never overflows
+        buffer |= value << count;
+        count += bits;
+        while (count >= 8) {
+            bytes->push_back((uint8_t)buffer);
+            buffer >>= 8;
+            count -= 8;
+        }
+    }
+    void Flush() {
+        if (count > 0) bytes->push_back((uint8_t)buffer);
+        buffer = 0;
+        count = 0;
+        // keep whatever follows aligned for doubles
+        while (bytes->size() % sizeof(double) != 0) bytes->push_back(0);
+    }
+};
+
+struct BitReader {
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+    uint64_t buffer = 0;
+    uint32_t count = 0;
+    void Refill() {
+        // top the buffer up to at least 56 bits with a single unaligned load away from the end
+        if (position + 8 <= size) {
+            uint64_t word;
+            std::memcpy(&word, data + position, sizeof(word));
+            buffer |= word << count;
+            position += (63 - count) >> 3;
+            count |= 56;
+            return;
+        }
+        while (count <= 56 && position < size) {
+            buffer |= (uint64_t)data[position++] << count;
+            count += 8;
+        }
+    }
+    uint64_t Get(uint32_t bits) {
+        if (bits == 0) return 0;
+        Refill();
+        uint64_t value = buffer & ((1ull << bits) - 1);
+        buffer >>= bits;
+        count -= bits;
+        return value;
+    }
+    uint64_t Rice(uint32_t k) {
+        // one refill covers any code short of the escape, which is at most 24 ones, the zero and 32 bits
+        Refill();
+        uint32_t quotient = TrailingOnes(buffer);
+        if (quotient < TRAJECTORY_ESCAPE) {
+            uint64_t value = ((uint64_t)quotient << k) | ((buffer >> (quotient + 1)) & ((1ull << k) - 1));
+            buffer >>= quotient + 1 + k;
+            count -= quotient + 1 + k;
+            return value;
+        }
+        buffer >>= TRAJECTORY_ESCAPE;
+        count -= TRAJECTORY_ESCAPE;
+        uint64_t value = Get(32);
+        return value | Get(32) << 32;
+    }
+};
+
+static void EncodeRice(const std::vector<uint64_t> &values, BitWriter &writer) {
+    // every block picks the parameter that codes it shortest, values too large for it escape to 64 raw bits
+    for (size_t begin = 0; begin < values.size(); begin += TRAJECTORY_BLOCK) {
+        size_t end = std::min(begin + (size_t)TRAJECTORY_BLOCK, values.size());
+        uint64_t sum = 0;
+        for (size_t i = begin; i < end; i++) sum += std::min(values[i], (uint64_t)1 << 40);
+        uint64_t mean = sum / (end - begin);
+        uint32_t guess = 0;
+        while (guess < 32 && (mean >> (guess + 1)) > 0) guess++;
+        uint32_t best = guess;
+        uint64_t shortest = UINT64_MAX;
+        for (uint32_t k = guess > 0 ? guess - 1 : 0; k <= std::min(guess + 1, 32u); k++) {
+            uint64_t bits = 0;
+            for (size_t i = begin; i < end; i++) bits += (values[i] >> k) < TRAJECTORY_ESCAPE ? (values[i] >> k) + 1 + k : TRAJECTORY_ESCAPE + 64;
+            if (bits < shortest) {
+                shortest = bits;
+                best = k;
+            }
+        }
+        writer.Put(best, 6);
+        for (size_t i = begin; i < end; i++) {
+            uint64_t quotient = values[i] >> best;
+            if (quotient < TRAJECTORY_ESCAPE) {
+                writer.Put((1ull << quotient) - 1, (uint32_t)quotient + 1);
+                if (best > 0) writer.Put(values[i] & ((1ull << best) - 1), best);
+            } else {
+                writer.Put((1ull << TRAJECTORY_ESCAPE) - 1, TRAJECTORY_ESCAPE);
+                writer.Put(values[i] & 0xffffffffull, 32);
+                writer.Put(values[i] >> 32, 32);
+            }
+        }
+    }
+}
+
+template<typename Ready>
+void TrajectoryWriter::Park(Ready ready) {
+    // spin briefly since the other side is usually just finishing a frame, then sleep until woken
+    for (size_t i = 0; i < TRAJECTORY_SPINS; i++) {
+        if (ready()) return;
+        std::this_thread::yield();
+    }
+    m_Sleepers.fetch_add(1);
+    {
+        std::unique_lock<std::mutex> lock(m_ParkLock);
+        m_ParkAlert.wait(lock, ready);
+    }
+    m_Sleepers.fetch_sub(1);
+}
+
+void TrajectoryWriter::Wake() {
+    // the counters were already stored, so only pay for the wakeup when someone went to sleep
+    if (m_Sleepers.load() == 0) return;
+    m_ParkLock.lock();
+    m_ParkLock.unlock();
+    m_ParkAlert.notify_all();
+}
+
+bool TrajectoryWriter::Open(const std::string &path, const std::vector<double> &radii, bool velocities, double timestep, double unitsize, double tolerance, uint64_t resume) {
+    Close();
+    uint32_t flags = (velocities ? TRAJECTORY_VELOCITIES : 0u) | (tolerance > 0.0 ? TRAJECTORY_COMPRESSED : 0u);
+    m_Header = { TRAJECTORY_MAGIC, TRAJECTORY_VERSION, flags, TRAJECTORY_ANCHOR_INTERVAL, (uint64_t)radii.size(), 0, timestep, unitsize, tolerance > 0.0 ? 2.0 * tolerance : 0.0 };
+    // the slots are sized once here so capturing a frame never allocates, any of them may carry a keyframe
+    m_Slots.resize(TRAJECTORY_SLOTS);
+    for (ParticleFrame& slot : m_Slots) {
+        slot.x.resize(radii.size());
+        slot.y.resize(radii.size());
+        slot.z.resize(radii.size());
+        slot.vx.resize(radii.size());
+        slot.vy.resize(radii.size());
+        slot.vz.resize(radii.size());
+    }
+    for (int32_t axis = 0; axis < 3; axis++) {
+        m_Previous[axis].assign(tolerance > 0.0 ? radii.size() : 0, 0);
+        m_Older[axis].assign(tolerance > 0.0 ? radii.size() : 0, 0);
+    }
+    m_Published.store(0);
+    m_Drained.store(0);
+    m_Closing.store(false);
+    std::error_code error;
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    if (!directory.empty()) std::filesystem::create_directories(directory, error);
+    m_Header.frames = resume > 0 ? Recover(path, resume) : 0;
+    if (m_Header.frames > 0) {
+        m_File.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        m_File.seekp(0, std::ios::end);
+        m_Bytes = (uint64_t)m_File.tellp();
+    } else {
+        m_File.open(path, std::ios::binary | std::ios::trunc);
+        m_File.write((const char*)&m_Header, sizeof(m_Header));
+        m_File.write((const char*)radii.data(), radii.size() * sizeof(double));
+        m_Bytes = sizeof(m_Header) + radii.size() * sizeof(double);
+    }
+    m_Failed = !m_File;
+    if (m_Failed) WARN("Could not open trajectory {} for writing", path);
+    // the writer drains even without a file so the simulation never waits on a full ring
+    m_Thread = std::thread(&TrajectoryWriter::Drain, this);
+    return !m_Failed;
+}
+
+uint64_t TrajectoryWriter::Recover(const std::string &path, uint64_t resume) {
+    // only a file recorded with the same layout is picked up, cut back to the whole frames before the resumed step
+    std::error_code error;
+    TrajectoryReader reader;
+    if (!std::filesystem::exists(path, error) || !reader.Open(path)) return 0;
+    const TrajectoryHeader& header = reader.Header();
+    if (header.flags != m_Header.flags || header.interval != m_Header.interval || header.particles != m_Header.particles ||
+        header.timestep != m_Header.timestep || header.unitsize != m_Header.unitsize || header.quantum != m_Header.quantum) return 0;
+    uint64_t kept = 0;
+    while (kept < reader.Frames() && reader.FrameStep(kept) < resume) kept++;
+    if (kept == 0) return 0;
+    // the frame count keeps the anchors in phase, and the prediction carries on from the last two kept frames
+    // rounded the way the encoder rounded them
+    if ((m_Header.flags & TRAJECTORY_COMPRESSED) != 0) {
+        double scale = 1.0 / m_Header.quantum;
+        for (uint64_t f = kept >= 2 ? kept - 2 : 0; f < kept; f++) {
+            reader.Seek(f);
+            for (int32_t axis = 0; axis < 3; axis++) {
+                for (size_t i = 0; i < m_Header.particles; i++) {
+                    m_Older[axis][i] = m_Previous[axis][i];
+                    m_Previous[axis][i] = (int64_t)std::floor(reader.Position(i)[axis] * scale + 0.5);
+                }
+            }
+        }
+    }
+    size_t end = reader.FrameEnd(kept - 1);
+    reader.Close();
+    std::filesystem::resize_file(path, end, error);
+    return error ? 0 : kept;
+}
+
+ParticleFrame* TrajectoryWriter::Acquire(uint64_t step, bool keyframe) {
+    // single producer, so only the writer can move the drained count while we look
+    uint64_t published = m_Published.load(std::memory_order_relaxed);
+    Park([this, published] { return published - m_Drained.load(std::memory_order_acquire) < TRAJECTORY_SLOTS; });
+    ParticleFrame* frame = &m_Slots[published % TRAJECTORY_SLOTS];
+    frame->step = step;
+    frame->keyframe = keyframe;
+    frame->velocities = keyframe || (m_Header.flags & TRAJECTORY_VELOCITIES) != 0;
+    return frame;
+}
+
+void TrajectoryWriter::Publish() {
+    m_Published.fetch_add(1);
+    Wake();
+}
+
+uint64_t TrajectoryWriter::Close() {
+    if (!m_Thread.joinable()) return m_Header.frames;
+    m_Closing.store(true);
+    Wake();
+    m_Thread.join();
+    // the frame count is only a hint for tools, readers trust the file length
+    m_File.seekp(0);
+    m_File.write((const char*)&m_Header, sizeof(m_Header));
+    m_File.close();
+    if (m_Failed) WARN("Trajectory writer failed after {} frames", m_Header.frames);
+    return m_Header.frames;
+}
+
+void TrajectoryWriter::Encode(const ParticleFrame &frame) {
+    // linear prediction from the two frames before in quantized units, so the decoder predicts exactly the same
+    // and errors never build up, anchors predict nothing and the frame after one only repeats it. keyframes are
+    // stored raw but still feed the prediction
+    size_t n = m_Header.particles;
+    uint64_t phase = m_Header.frames % m_Header.interval;
+    const std::vector<double>* axes[3] = { &frame.x, &frame.y, &frame.z };
+    double scale = 1.0 / m_Header.quantum;
+    m_Residuals.resize(3 * n);
+    for (int32_t axis = 0; axis < 3; axis++) {
+        const double* x = axes[axis]->data();
+        int64_t* previous = m_Previous[axis].data();
+        int64_t* older = m_Older[axis].data();
+        uint64_t* residuals = m_Residuals.data() + axis * n;
+        for (size_t i = 0; i < n; i++) {
+            int64_t q = (int64_t)std::floor(x[i] * scale + 0.5);
+            int64_t predicted = phase == 0 ? 0 : (phase == 1 ? previous[i] : 2 * previous[i] - older[i]);
+            int64_t residual = q - predicted;
+            residuals[i] = ((uint64_t)residual << 1) ^ (uint64_t)(residual >> 63);
+            older[i] = previous[i];
+            previous[i] = q;
+        }
+    }
+    m_Packed.clear();
+    if (frame.keyframe) return;
+    BitWriter writer = { &m_Packed };
+    EncodeRice(m_Residuals, writer);
+    writer.Flush();
+}
+
+void TrajectoryWriter::Drain() {
+    bool compressed = (m_Header.flags & TRAJECTORY_COMPRESSED) != 0;
+    size_t bytes = m_Header.particles * sizeof(double);
+    while (true) {
+        uint64_t drained = m_Drained.load(std::memory_order_relaxed);
+        Park([this, drained] { return m_Published.load(std::memory_order_acquire) != drained || m_Closing.load(); });
+        if (m_Published.load(std::memory_order_acquire) == drained) return;
+        // keep draining after a failure so the simulation never blocks on a full ring
+        const ParticleFrame& frame = m_Slots[drained % TRAJECTORY_SLOTS];
+        if (!m_Failed) {
+            if (compressed) Encode(frame);
+            bool packed = compressed && !frame.keyframe;
+            TrajectoryFrameHeader header = { 0, frame.step, (frame.velocities ? TRAJECTORY_VELOCITIES : 0u) | (frame.keyframe ? TRAJECTORY_KEYFRAME : 0u) };
+            header.size = (packed ? m_Packed.size() : 3 * bytes) + (frame.velocities ? 3 * bytes : 0);
+            m_File.write((const char*)&header, sizeof(header));
+            if (packed) {
+                m_File.write((const char*)m_Packed.data(), m_Packed.size());
+            } else {
+                m_File.write((const char*)frame.x.data(), bytes);
+                m_File.write((const char*)frame.y.data(), bytes);
+                m_File.write((const char*)frame.z.data(), bytes);
+            }
+            if (frame.velocities) {
+                m_File.write((const char*)frame.vx.data(), bytes);
+                m_File.write((const char*)frame.vy.data(), bytes);
+                m_File.write((const char*)frame.vz.data(), bytes);
+            }
+            m_Bytes += sizeof(header) + header.size;
+            if (!m_File) m_Failed = true;
+            else m_Header.frames++;
+        }
+        m_Drained.fetch_add(1);
+        Wake();
+    }
+}
+
+bool TrajectoryReader::Open(const std::string &path) {
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        WARN("Could not open trajectory {}", path);
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    m_File = file;
+    m_Length = (size_t)size.QuadPart;
+    if (m_Length >= sizeof(TrajectoryHeader)) {
+        m_Mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_Mapping) m_Data = (const uint8_t*)MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        WARN("Could not open trajectory {}", path);
+        return false;
+    }
+    struct stat info;
+    fstat(file, &info);
+    m_File = file;
+    m_Length = (size_t)info.st_size;
+    if (m_Length >= sizeof(TrajectoryHeader)) {
+        void* data = mmap(nullptr, m_Length, PROT_READ, MAP_SHARED, file, 0);
+        if (data != MAP_FAILED) m_Data = (const uint8_t*)data;
+    }
+#endif
+    if (m_Data == nullptr) {
+        WARN("Could not map trajectory {}", path);
+        Close();
+        return false;
+    }
+    m_Header = *reinterpret_cast<const TrajectoryHeader*>(m_Data);
+    m_Offset = sizeof(TrajectoryHeader) + m_Header.particles * sizeof(double);
+    if (m_Header.magic != TRAJECTORY_MAGIC || m_Header.version != TRAJECTORY_VERSION || m_Offset > m_Length || (Compressed() && (m_Header.quantum <= 0.0 || m_Header.interval == 0))) {
+        WARN("Ignoring unreadable trajectory {}", path);
+        Close();
+        return false;
+    }
+    // hop over every frame once so seeking can jump straight to it or its anchor, a writer that never got to
+    // close leaves whole frames behind all the same
+    size_t offset = m_Offset;
+    while (m_Length - offset >= sizeof(TrajectoryFrameHeader)) {
+        const TrajectoryFrameHeader* header = reinterpret_cast<const TrajectoryFrameHeader*>(m_Data + offset);
+        if (header->size > m_Length - offset - sizeof(TrajectoryFrameHeader)) break;
+        m_Index.push_back(offset);
+        offset += sizeof(TrajectoryFrameHeader) + header->size;
+    }
+    m_Frames = m_Index.size();
+    if (Compressed()) {
+        for (int32_t axis = 0; axis < 3; axis++) {
+            m_Previous[axis].assign(m_Header.particles, 0);
+            m_Older[axis].assign(m_Header.particles, 0);
+            m_Decoded[axis].assign(m_Header.particles, 0.0);
+        }
+        m_Residuals.resize(3 * m_Header.particles);
+    }
+    m_Radii = reinterpret_cast<const double*>(m_Data + sizeof(TrajectoryHeader));
+    m_Path = path;
+    return true;
+}
+
+bool TrajectoryReader::Seek(uint64_t frame) {
+    if (frame >= m_Frames) return false;
+    if (frame == m_Current) return true;
+    // playing forward only decodes the next frame, anything else starts over from the anchor
+    if (Compressed()) {
+        uint64_t start = m_Current != UINT64_MAX && frame == m_Current + 1 ? frame : frame - frame % m_Header.interval;
+        for (uint64_t f = start; f <= frame; f++) Decode(f);
+    }
+    m_Frame = reinterpret_cast<const TrajectoryFrameHeader*>(m_Data + m_Index[frame]);
+    const double* payload = reinterpret_cast<const double*>(m_Frame + 1);
+    size_t n = m_Header.particles;
+    for (size_t block = 0; block < 3; block++) m_Blocks[block] = Compressed() ? m_Decoded[block].data() : payload + block * n;
+    // velocities sit raw behind the positions
+    if (FrameVelocities()) {
+        const double* velocities = reinterpret_cast<const double*>((const uint8_t*)payload + m_Frame->size) - 3 * n;
+        for (size_t block = 0; block < 3; block++) m_Blocks[3 + block] = velocities + block * n;
+    }
+    m_Current = frame;
+    return true;
+}
+
+void TrajectoryReader::Decode(uint64_t frame) {
+    size_t n = m_Header.particles;
+    const TrajectoryFrameHeader* header = reinterpret_cast<const TrajectoryFrameHeader*>(m_Data + m_Index[frame]);
+    const uint8_t* payload = reinterpret_cast<const uint8_t*>(header + 1);
+    uint64_t phase = frame % m_Header.interval;
+    double quantum = m_Header.quantum;
+    if ((header->flags & TRAJECTORY_KEYFRAME) != 0) {
+        // keyframes hold the exact positions, rounding them again keeps the prediction in step with the writer
+        double scale = 1.0 / quantum;
+        for (int32_t axis = 0; axis < 3; axis++) {
+            const double* x = reinterpret_cast<const double*>(payload) + axis * n;
+            int64_t* previous = m_Previous[axis].data();
+            int64_t* older = m_Older[axis].data();
+            for (size_t i = 0; i < n; i++) {
+                older[i] = previous[i];
+                previous[i] = (int64_t)std::floor(x[i] * scale + 0.5);
+            }
+            std::memcpy(m_Decoded[axis].data(), x, n * sizeof(double));
+        }
+        return;
+    }
+    BitReader reader = { payload, (size_t)header->size };
+    for (size_t value = 0; value < 3 * n; value += TRAJECTORY_BLOCK) {
+        uint32_t k = (uint32_t)reader.Get(6);
+        size_t last = std::min(value + (size_t)TRAJECTORY_BLOCK, 3 * n);
+        for (size_t i = value; i < last; i++) m_Residuals[i] = reader.Rice(k);
+    }
+    for (int32_t axis = 0; axis < 3; axis++) {
+        const uint64_t* residuals = m_Residuals.data() + axis * n;
+        int64_t* previous = m_Previous[axis].data();
+        int64_t* older = m_Older[axis].data();
+        double* decoded = m_Decoded[axis].data();
+        for (size_t i = 0; i < n; i++) {
+            int64_t residual = (int64_t)(residuals[i] >> 1) ^ -(int64_t)(residuals[i] & 1);
+            int64_t predicted = phase == 0 ? 0 : (phase == 1 ? previous[i] : 2 * previous[i] - older[i]);
+            int64_t q = predicted + residual;
+            older[i] = previous[i];
+            previous[i] = q;
+            decoded[i] = (double)q * quantum;
+        }
+    }
+}
+
+void TrajectoryReader::Close() {
+#ifdef _WIN32
+    if (m_Data) UnmapViewOfFile(m_Data);
+    if (m_Mapping) CloseHandle(m_Mapping);
+    if (m_File) CloseHandle(m_File);
+    m_Mapping = nullptr;
+    m_File = nullptr;
+#else
+    if (m_Data) munmap((void*)m_Data, m_Length);
+    if (m_File >= 0) close(m_File);
+    m_File = -1;
+#endif
+    m_Data = nullptr;
+    m_Radii = nullptr;
+    m_Length = 0;
+    m_Frames = 0;
+    m_Current = UINT64_MAX;
+    m_Frame = nullptr;
+    m_Index.clear();
+    m_Residuals.clear();
+    m_Header = {};
+    m_Path.clear();
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include "Simulation/ParticleSoA.h"
+#include <glm/glm.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRAJECTORY_DIRECTORY "cache"
+#define TRAJECTORY_VERSION 3
+#define TRAJECTORY_SLOTS 3
+#define TRAJECTORY_SPINS 1024
+#define TRAJECTORY_VELOCITIES 0x1u
+#define TRAJECTORY_COMPRESSED 0x2u
+#define TRAJECTORY_KEYFRAME 0x4u
+#define TRAJECTORY_ANCHOR_INTERVAL 64
+#define TRAJECTORY_BLOCK 256
+#define TRAJECTORY_ESCAPE 24
+
+// a trajectory file is this header, one radius per particle, then every recorded frame behind a frame header.
+// raw frames are x, y and z blocks followed by vx, vy and vz blocks when the frame keeps velocities, all doubles
+// in simulation units. compressed frames hold the positions rounded to the quantum and rice coded as residuals
+// against the two frames before, except on anchors every interval frames so playback can seek, then any raw
+// velocity blocks. keyframes are always raw and always keep velocities, so a run can be restarted from them
+struct TrajectoryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t interval;
+    uint64_t particles;
+    uint64_t frames;
+    double timestep;
+    double unitsize;
+    double quantum;
+};
+
+struct TrajectoryFrameHeader {
+    uint64_t size;
+    uint64_t step;
+    uint64_t flags;
+};
+
+// streams frames to disk on its own thread through a ring of preallocated snapshot slots, the simulation fills
+// the next free slot and publishes it, and only waits when the disk falls a whole ring behind. a positive
+// tolerance compresses the positions on the writer thread, keeping each within it of the simulated one. a run
+// resuming at a step appends to the file its interrupted run left behind, after the frames recorded before it
+class TrajectoryWriter {
+public:
+    ~TrajectoryWriter() { Close(); }
+    bool Open(const std::string &path, const std::vector<double> &radii, bool velocities, double timestep, double unitsize, double tolerance = 0.0, uint64_t resume = 0);
+    ParticleFrame* Acquire(uint64_t step, bool keyframe = false);
+    void Publish();
+    uint64_t Close();
+    bool Failed() { return m_Failed; }
+    uint64_t Bytes() { return m_Bytes; }
+    uint64_t Frames() { return m_Header.frames; }
+private:
+    uint64_t Recover(const std::string &path, uint64_t resume);
+    void Drain();
+    void Encode(const ParticleFrame &frame);
+    template<typename Ready> void Park(Ready ready);
+    void Wake();
+private:
+    std::ofstream m_File;
+    std::thread m_Thread;
+    std::vector<ParticleFrame> m_Slots;
+    std::atomic<uint64_t> m_Published = 0;
+    std::atomic<uint64_t> m_Drained = 0;
+    std::atomic<bool> m_Closing = false;
+    std::atomic<uint32_t> m_Sleepers = 0;
+    std::mutex m_ParkLock;
+    std::condition_variable m_ParkAlert;
+    TrajectoryHeader m_Header = {};
+    bool m_Failed = false;
+    uint64_t m_Bytes = 0;
+private:
+    std::vector<int64_t> m_Previous[3];
+    std::vector<int64_t> m_Older[3];
+    std::vector<uint64_t> m_Residuals;
+    std::vector<uint8_t> m_Packed;
+};
+
+// maps a finished trajectory read only, so playback pages frames in as it reaches them, compressed frames are
+// decoded forward from the last one or from their anchor. frames play in recorded order, each knows its step
+class TrajectoryReader {
+public:
+    ~TrajectoryReader() { Close(); }
+    bool Open(const std::string &path);
+    void Close();
+    bool IsOpen() { return m_Data != nullptr; }
+    const std::string& Path() { return m_Path; }
+    const TrajectoryHeader& Header() { return m_Header; }
+    uint64_t Frames() { return m_Frames; }
+    uint64_t Particles() { return m_Header.particles; }
+    bool Velocities() { return (m_Header.flags & TRAJECTORY_VELOCITIES) != 0; }
+    bool Compressed() { return (m_Header.flags & TRAJECTORY_COMPRESSED) != 0; }
+    double Tolerance() { return 0.5 * m_Header.quantum; }
+    double Timestep() { return m_Header.timestep; }
+    double Radius(size_t i) { return m_Radii[i]; }
+public:
+    bool Seek(uint64_t frame);
+    uint64_t Step() { return m_Frame->step; }
+    bool Keyframe() { return (m_Frame->flags & TRAJECTORY_KEYFRAME) != 0; }
+    bool IsKeyframe(uint64_t frame) { return (reinterpret_cast<const TrajectoryFrameHeader*>(m_Data + m_Index[frame])->flags & TRAJECTORY_KEYFRAME) != 0; }
+    uint64_t FrameStep(uint64_t frame) { return reinterpret_cast<const TrajectoryFrameHeader*>(m_Data + m_Index[frame])->step; }
+    size_t FrameEnd(uint64_t frame) { return m_Index[frame] + sizeof(TrajectoryFrameHeader) + reinterpret_cast<const TrajectoryFrameHeader*>(m_Data + m_Index[frame])->size; }
+    bool FrameVelocities() { return (m_Frame->flags & TRAJECTORY_VELOCITIES) != 0; }
+    glm::dvec3 Position(size_t i) { return { m_Blocks[0][i], m_Blocks[1][i], m_Blocks[2][i] }; }
+    glm::dvec3 Velocity(size_t i) { return { m_Blocks[3][i], m_Blocks[4][i], m_Blocks[5][i] }; }
+private:
+    void Decode(uint64_t frame);
+private:
+    std::string m_Path;
+    TrajectoryHeader m_Header = {};
+    const uint8_t* m_Data = nullptr;
+    const double* m_Radii = nullptr;
+    size_t m_Length = 0;
+    size_t m_Offset = 0;
+    uint64_t m_Frames = 0;
+    uint64_t m_Current = UINT64_MAX;
+    const TrajectoryFrameHeader* m_Frame = nullptr;
+    const double* m_Blocks[6] = {};
+    std::vector<size_t> m_Index;
+    std::vector<int64_t> m_Previous[3];
+    std::vector<int64_t> m_Older[3];
+    std::vector<double> m_Decoded[3];
+    std::vector<uint64_t> m_Residuals;
+#ifdef _WIN32
+    void* m_File = nullptr;
+    void* m_Mapping = nullptr;
+#else
+    int m_File = -1;
+#endif
+};